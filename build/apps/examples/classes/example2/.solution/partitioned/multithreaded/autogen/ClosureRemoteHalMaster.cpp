@@ -6,6 +6,7 @@
 
 using namespace std;
 
-// std::map<void *, int> instanceMap;
-
-int ClosureRemoteHalMaster::nextOid = 0;
\ No newline at end of file
+std::atomic<int> ClosureRemoteHalMaster::nextOid { 0 };
+std::unique_ptr<closure::Transport> ClosureRemoteHalMaster::transport;
+std::unique_ptr<closure::RpcMaster> ClosureRemoteHalMaster::rpc;
+std::once_flag ClosureRemoteHalMaster::connected;
\ No newline at end of file
@@ -1,63 +1,79 @@
 /*******************************************************************************
  *
  *******************************************************************************/
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <map>
 #include <iostream>
 
 #include "codec.h"
+#include "ClosureRpc.hpp"
+#include "ShmRing.hpp"
 // #include "ExtraShadow.hpp"
 
-// std::map<void *, int> instanceMap;
-
 using namespace std;
 
 class ClosureRemoteHalMaster
 {
 private:
-    static int nextOid;
+    static std::atomic<int> nextOid;
+    static std::unique_ptr<closure::Transport> transport;
+    static std::unique_ptr<closure::RpcMaster> rpc;
+    static std::once_flag connected;
 
 public:
-    static int instantiateExtra() { /// int oid, String fqcn, Class<?>[] argTypes, Object[] args) {
-        uint32_t oid = nextOid++;
-        
+    // Uses the given transport instead of the default shared-memory channel
+    // (CLOSURE_CHANNEL, /closure-example2); call before the first RPC
+    static void connect(std::unique_ptr<closure::Transport> with) {
+        std::call_once(connected, [&]() {
+            transport = std::move(with);
+            rpc = std::make_unique<closure::RpcMaster>(*transport);
+        });
+    }
+
+    static closure::RpcMaster &master() {
+        std::call_once(connected, []() {
+            const char *name = getenv("CLOSURE_CHANNEL");
+            transport = std::make_unique<closure::ShmChannel>(
+                name ? name : "/closure-example2", closure::ShmChannel::MASTER, false);
+            rpc = std::make_unique<closure::RpcMaster>(*transport);
+        });
+        return *rpc;
+    }
+
+    // Stops the runtime and the slave
+    static void disconnect() {
+        rpc.reset();
+        transport.reset();
+    }
+
+    // Sets oid and resolves once the slave has constructed the object.
+    // Calls on the oid may be issued before that; they are run in order.
+    static std::future<okay_datatype> instantiateExtraAsync(int &oid) {
+        oid = nextOid++;
+
         request_extraconstructor_datatype data;
-        request_extraconstructor_output serialized;
-        size_t len_out;
         data.oid = oid;
-        request_extraconstructor_data_encode(&serialized, &data, &len_out);
-
-        cout << "RPC instantiateExtra" <<  serialized.trailer.seq << endl;
-         
-        // String inUri = IPC.getInUri();
-        // String outUri = IPC.getOutUri();
-        // HalZmq halzmq = new HalZmq(outUri, inUri, outTag);
-        // halzmq.xdc_asyn_send((char *)payload[0], outTag);
-        // halzmq.shutdown();
+        return master().call<okay_datatype>(
+            DATA_TYP_REQUEST_EXTRACONSTRUCTOR, data, oid, DATA_TYP_OKAY);
+    }
 
+    static int instantiateExtra() { /// int oid, String fqcn, Class<?>[] argTypes, Object[] args) {
+        int oid;
+        instantiateExtraAsync(oid).get();
         return oid;
     }
-    
-    static int invokeExtraGetValue(int oid) {
+
+    static std::future<response_eaxtragetvalueret_datatype> invokeExtraGetValueAsync(int oid) {
         request_extragetvalue_datatype data;
-        request_extragetvalue_output   serialized;
-        size_t len_out;
         data.oid = oid;
+        return master().call<response_eaxtragetvalueret_datatype>(
+            DATA_TYP_REQUEST_EXTRAGETVALUE, data, oid, DATA_TYP_RESPONSE_EAXTRAGETVALUERET);
+    }
 
-        request_extragetvalue_data_decode(&serialized, &data, &len_out);
-
-        // GapsTag tag; //  = RPCObjectTag.lookup(obj.getUid());
-        int tag = 0;
-        cout << "RPC instantiateExtra" <<  serialized.trailer.seq << endl;
-         
-        // String inUri = IPC.getInUri();
-        // String outUri = IPC.getOutUri();
-        // HalZmq halzmq = new HalZmq(outUri, inUri, outTag);
-        // halzmq.xdc_asyn_send((char *)payload[0], outTag);
-
-        // SDH sdh = halzmq.xdc_blocking_recv();
-        
-        // return getValue.value();
-        return 0;
+    static int invokeExtraGetValue(int oid) {
+        return invokeExtraGetValueAsync(oid).get().value;
     }
 };
\ No newline at end of file
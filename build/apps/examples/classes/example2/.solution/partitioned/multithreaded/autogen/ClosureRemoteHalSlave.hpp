@@ -1,101 +1,74 @@
+#include <iostream>
 #include <string>
+#include <thread>
 
 #include "codec.h"
+#include "ClosureRpc.hpp"
+#include "ShmRing.hpp"
 #include "Extra.hpp"
 
 using namespace std;
 
-std::map<int, void *> instanceMap;
-
 // generated
 class ClosureRemoteHalSlave
 {
 public:
-    ClosureRemoteHalSlave() {
+    ClosureRemoteHalSlave(closure::Transport &transport, unsigned workers)
+        : rpc(transport, workers) {
+        rpc.handle<request_extraconstructor_datatype>(DATA_TYP_REQUEST_EXTRACONSTRUCTOR,
+            [this](const request_extraconstructor_datatype &request) { constructExtra(request); });
+        rpc.handle<request_extragetvalue_datatype>(DATA_TYP_REQUEST_EXTRAGETVALUE,
+            [this](const request_extragetvalue_datatype &request) { extraGetValue(request); });
     }
 
+    // Serves the shared-memory channel (CLOSURE_CHANNEL, /closure-example2)
+    // until the master disconnects
     static void init() {
-        ClosureRemoteHalSlave slave;
+        const char *name = getenv("CLOSURE_CHANNEL");
+        closure::ShmChannel transport(name ? name : "/closure-example2",
+                                      closure::ShmChannel::SLAVE, true);
+        ClosureRemoteHalSlave slave(transport, std::thread::hardware_concurrency());
         slave.listen();
     }
 
-private:
     void listen() {
-        while (true) {
-            // String inUri = IPC.getInUri();
-            // String outUri = IPC.getOutUri();
-            // GapsTag outTag = RPCObjectTag.lookup("response"); 
-            // HalZmq halzmq = new HalZmq(outUri, inUri, outTag); // outTag will be replaced later
-            // SDH sdh = halzmq.xdc_blocking_recv();
-            // sdh.getData()
-            // 
-            string buf; // (data.begin(), data.end());
-            auto message = std::make_unique<closure::ClosureMessage>();
-            message->ParseFromString(buf);
-
-            if (message->has_extra_constructor()) {
-                const closure::ExtraConstructor &ctor = message->extra_constructor();
-                uint32_t oid = ctor.oid();
-
-                void *obj = instanceMap[oid];
-                if (obj != NULL) {
-                    std::cerr << "Extra object already exists: " << oid << endl;
-                }
-                Extra *extra = new Extra();
-
-                instanceMap[oid] = extra;
-            }
-            else if (message->has_extra_getvalue()) {
-                const closure::ExtraGetValue &getValue = message->extra_getvalue();
-                uint32_t oid = getValue.oid();
+        rpc.run();
+    }
 
-                void *obj = instanceMap[oid];
-                if (obj == NULL) {
-                    std::cerr << "Extra object does not exist: " << oid << endl;
-                    return;
-                }
+    double batchSize() { return rpc.batch_size(); }
 
-                Extra *extra = (Extra *) obj;
-                int value = extra->getValue();
+private:
+    // Requests on one oid are handled by one worker, in order
 
-                closure::ClosureMessage message;
-                closure::ExtraGetValueRet *ret = new closure::ExtraGetValueRet();
-                ret->set_oid(value);
-                message.set_allocated_extra_getvalue_ret(ret);
+    void constructExtra(const request_extraconstructor_datatype &request) {
+        uint32_t oid = request.oid;
+        if (!instances.insert(oid, std::make_unique<Extra>())) {
+            std::cerr << "Extra object already exists: " << oid << endl;
+            rpc.fail(request, 1);
+            return;
+        }
 
-                string buf;
-                message.SerializeToString(&buf);
+        okay_datatype okay;
+        okay.x = 0;
+        rpc.reply(request, DATA_TYP_OKAY, okay);
+    }
 
-                // GapsTag tag = RPCObjectTag.lookup(method.getUidResponse());
-                int tag = 0; // TODO
-                std::cout << "RPC response " << tag << endl;
-                // halzmq.xdc_asyn_send((char *)buf[0], tag);
-            }    
-            else if (message->has_extra_getvalue_ret()) {
-            }
-            // else if (o instanceof RPCField) {
-            //     RPCField field = (RPCField) o;
-            //     if (field.isWrite()) {
-            //         if (field.isStatic())
-            //             writeStaticField(field);
-            //         else
-            //             writeField(field);
-            //     }
-            //     else {
-            //         Object obj;
-            //         if (field.isStatic())
-            //             obj = readStaticField(field);
-            //         else
-            //             obj = readField(field);
-                
-            //         byte[] adu = Serializer.serialize(obj);
-            //         GapsTag tag = RPCObjectTag.lookup(field.getUidResponse());
-            //         System.out.println("RPC response " + tag.toString());
-            //         halzmq.xdc_asyn_send(adu, tag);
-            //     }
-            // }
-            // halzmq.shutdown();
+    void extraGetValue(const request_extragetvalue_datatype &request) {
+        uint32_t oid = request.oid;
+        response_eaxtragetvalueret_datatype ret;
+        ret.oid = oid;
+        bool found = instances.with(oid, [&](std::unique_ptr<Extra> &extra) {
+            ret.value = extra->getValue();
+        });
+        if (!found) {
+            std::cerr << "Extra object does not exist: " << oid << endl;
+            rpc.fail(request, 2);
+            return;
         }
+
+        rpc.reply(request, DATA_TYP_RESPONSE_EAXTRAGETVALUERET, ret);
     }
-};
 
+    closure::RpcSlave rpc;
+    closure::ShardedMap<uint32_t, std::unique_ptr<Extra>> instances;
+};
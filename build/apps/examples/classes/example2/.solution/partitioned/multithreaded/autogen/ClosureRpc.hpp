@@ -0,0 +1,540 @@
+/*******************************************************************************
+ * Pipelined RPC runtime behind ClosureRemoteHalMaster/ClosureRemoteHalSlave
+ *
+ * A frame carries one or more records, each a DATA_TYP_* (network order)
+ * followed by the message encoded by codec.hpp. Requests and responses
+ * carry the call in their trailer: seq identifies the call, oid the object
+ * and mid the type of the request.
+ *
+ * - RpcMaster returns a future per call and matches responses by
+ *   trailer.seq (checking trailer.oid), so any number of calls can be in
+ *   flight. Once the transport closes, every call still waiting and every
+ *   later call fails with RemoteError.
+ * - Batcher groups the records posted while a send is in progress into the
+ *   next frame, so that under load many calls share one send. A thread can
+ *   hold a batch to send the records it posts together; holds are per
+ *   thread, so one slave worker never delays the replies of another.
+ * - RpcSlave hands every request to one of its workers by oid, so the calls
+ *   on an object run in order while different objects run in parallel.
+ * - ShardedMap is the concurrent table of pending calls and remote objects.
+ *******************************************************************************/
+#pragma once
+
+#include <arpa/inet.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "codec.hpp"
+
+namespace closure {
+
+class Transport
+{
+public:
+    virtual ~Transport() {}
+
+    // Sends one frame, false if the transport is closed and the frame was
+    // dropped; may be called from several threads
+    virtual bool send(const void *frame, size_t len) = 0;
+
+    // Receives the next frame, false once the transport is shut down
+    virtual bool recv(std::vector<uint8_t> &frame) = 0;
+
+    virtual void shutdown() = 0;
+};
+
+/*
+ * Frames
+ */
+
+template <typename Message>
+inline void append_record(std::vector<uint8_t> &frame, uint32_t typ, const Message &message)
+{
+    size_t pos = frame.size();
+    frame.resize(pos + sizeof(uint32_t) + sizeof(Message));
+    uint32_t wire_typ = htonl(typ);
+    std::memcpy(&frame[pos], &wire_typ, sizeof(wire_typ));
+    codec::encode(message, &frame[pos + sizeof(uint32_t)]);
+}
+
+// Calls f(typ, wire message, trailer) for every record of a frame
+template <typename F>
+inline void for_each_record(const std::vector<uint8_t> &frame, F f)
+{
+    size_t pos = 0;
+    while (pos + sizeof(uint32_t) <= frame.size()) {
+        uint32_t typ;
+        std::memcpy(&typ, &frame[pos], sizeof(typ));
+        typ = ntohl(typ);
+        size_t size = codec::message_size(typ);
+        pos += sizeof(uint32_t);
+        if (size == 0 || pos + size > frame.size()) {
+            fprintf(stderr, "closure rpc: malformed frame, record type %u\n", typ);
+            return;
+        }
+
+        trailer_datatype trailer;
+        codec::decode(&frame[pos + size - sizeof(trailer_datatype)], trailer);
+        f(typ, &frame[pos], trailer);
+        pos += size;
+    }
+}
+
+class Batcher
+{
+public:
+    explicit Batcher(Transport &transport, size_t max_frame = 64 * 1024)
+        : transport(transport), max_frame(max_frame) {
+    }
+
+    // The first poster sends; whoever posts while it sends is carried in
+    // the next frame. A thread holding a batch collects its posts apart.
+    template <typename Message>
+    void post(uint32_t typ, const Message &message) {
+        const size_t size = sizeof(uint32_t) + sizeof(Message);
+        if (Held *held = held_here()) {
+            // a full batch is sent even if it is still held
+            if (held->records.size() + size > max_frame)
+                submit(*held);
+            append_record(held->records, typ, message);
+            held->count++;
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        make_room(lock, size);
+        append_record(pending, typ, message);
+        records++;
+        flush(lock);
+    }
+
+    // Posts of this thread between hold() and release() are sent together;
+    // other threads, holding or not, are not delayed by it
+    void hold() {
+        Held *held = held_here();
+        if (!held) {
+            holds().push_back({ this, 0, {}, 0 });
+            held = &holds().back();
+        }
+        held->depth++;
+    }
+
+    void release() {
+        Held *held = held_here();
+        if (--held->depth > 0)
+            return;
+        submit(*held);
+        std::vector<Held> &all = holds();
+        all.erase(all.begin() + (held - all.data()));
+    }
+
+    // whether a send found the transport closed
+    bool closed() const { return transport_closed.load(); }
+
+    // records per frame so far
+    double batch_size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return frames ? double(records) / frames : 0;
+    }
+
+private:
+    // the records a thread has posted to one batcher while holding it
+    struct Held {
+        Batcher *batcher;
+        unsigned depth;
+        std::vector<uint8_t> records;
+        uint64_t count;
+    };
+
+    static std::vector<Held> &holds() {
+        thread_local std::vector<Held> held;
+        return held;
+    }
+
+    Held *held_here() {
+        for (Held &held : holds()) {
+            if (held.batcher == this)
+                return &held;
+        }
+        return nullptr;
+    }
+
+    // Queues a held batch as a whole, in the frame being filled if it fits
+    void submit(Held &held) {
+        if (held.records.empty())
+            return;
+        std::unique_lock<std::mutex> lock(mutex);
+        make_room(lock, held.records.size());
+        pending.insert(pending.end(), held.records.begin(), held.records.end());
+        records += held.count;
+        held.records.clear();
+        held.count = 0;
+        flush(lock);
+    }
+
+    void make_room(std::unique_lock<std::mutex> &lock, size_t size) {
+        while (pending.size() + size > max_frame) {
+            if (sending)
+                drained.wait(lock);
+            else
+                flush(lock);
+        }
+    }
+
+    void flush(std::unique_lock<std::mutex> &lock) {
+        if (sending)
+            return;
+        sending = true;
+        while (!pending.empty()) {
+            frame.swap(pending);
+            pending.clear();
+            frames++;
+            lock.unlock();
+            drained.notify_all();
+            if (!transport.send(frame.data(), frame.size()))
+                transport_closed.store(true);
+            lock.lock();
+        }
+        sending = false;
+        drained.notify_all();
+    }
+
+    Transport &transport;
+    const size_t max_frame;
+    std::mutex mutex;
+    std::condition_variable drained;
+    std::vector<uint8_t> pending, frame;
+    bool sending = false;
+    uint64_t records = 0, frames = 0;
+    std::atomic<bool> transport_closed { false };
+};
+
+/*
+ * Concurrent table, split into independently locked shards
+ */
+
+template <typename Key, typename Value, size_t Shards = 64>
+class ShardedMap
+{
+public:
+    // false if the key is present
+    bool insert(const Key &key, Value value) {
+        Shard &shard = shard_of(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return shard.map.emplace(key, std::move(value)).second;
+    }
+
+    // Removes the value into out; false if absent
+    bool take(const Key &key, Value &out) {
+        Shard &shard = shard_of(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end())
+            return false;
+        out = std::move(it->second);
+        shard.map.erase(it);
+        return true;
+    }
+
+    // Calls f(value) under the shard lock; false if absent
+    template <typename F>
+    bool with(const Key &key, F f) {
+        Shard &shard = shard_of(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end())
+            return false;
+        f(it->second);
+        return true;
+    }
+
+    // Removes every value and calls f(value) on it, outside the locks
+    template <typename F>
+    void drain(F f) {
+        for (Shard &shard : shards) {
+            std::unordered_map<Key, Value> taken;
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                taken.swap(shard.map);
+            }
+            for (auto &entry : taken)
+                f(entry.second);
+        }
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<Key, Value> map;
+    };
+
+    Shard &shard_of(const Key &key) { return shards[std::hash<Key>()(key) % Shards]; }
+
+    Shard shards[Shards];
+};
+
+class RemoteError : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/*
+ * Master side
+ */
+
+class RpcMaster
+{
+public:
+    explicit RpcMaster(Transport &transport)
+        : transport(transport), batcher(transport), receiver([this]() { receive(); }) {
+    }
+
+    ~RpcMaster() {
+        transport.shutdown();
+        receiver.join();
+    }
+
+    // Sends request and resolves to the response of type response_typ. An
+    // okay_datatype response with x != 0 fails the call with RemoteError,
+    // and so does a closed transport.
+    template <typename Response, typename Request>
+    std::future<Response> call(uint32_t typ, Request request, uint32_t oid, uint32_t response_typ) {
+        uint32_t seq = next_seq++;
+        request.trailer.seq = seq;
+        request.trailer.rqr = 0;
+        request.trailer.oid = oid;
+        request.trailer.mid = uint16_t(typ);
+        request.trailer.crc = 0;
+
+        auto promise = std::make_shared<std::promise<Response>>();
+        std::future<Response> future = promise->get_future();
+        Pending handler = [promise, response_typ](uint32_t typ, const uint8_t *wire) {
+            if (!wire) {
+                promise->set_exception(std::make_exception_ptr(
+                    RemoteError("transport closed")));
+                return;
+            }
+            if (typ == DATA_TYP_OKAY) {
+                okay_datatype status;
+                codec::decode(wire, status);
+                if (status.x != 0) {
+                    promise->set_exception(std::make_exception_ptr(
+                        RemoteError("remote call failed with status " + std::to_string(status.x))));
+                    return;
+                }
+            }
+            if (typ != response_typ) {
+                promise->set_exception(std::make_exception_ptr(
+                    RemoteError("unexpected response type " + std::to_string(typ))));
+                return;
+            }
+            Response response;
+            codec::decode(wire, response);
+            promise->set_value(response);
+        };
+        pending.insert(seq, { oid, std::move(handler) });
+
+        // checked after the insert, so that either this call or
+        // fail_pending() sees the other
+        if (closed.load()) {
+            Call call;
+            if (pending.take(seq, call))
+                call.handler(0, nullptr);
+            return future;
+        }
+
+        batcher.post(typ, request);
+        if (batcher.closed())
+            fail_pending();
+        return future;
+    }
+
+    // Calls made on this thread while a Batch is alive are sent in one
+    // frame when it ends
+    class Batch
+    {
+    public:
+        explicit Batch(RpcMaster &master) : batcher(master.batcher) { batcher.hold(); }
+        ~Batch() { batcher.release(); }
+        Batch(const Batch &) = delete;
+        Batch &operator=(const Batch &) = delete;
+
+    private:
+        Batcher &batcher;
+    };
+
+    double batch_size() { return batcher.batch_size(); }
+
+private:
+    // wire is null when the transport closed before the response came
+    using Pending = std::function<void(uint32_t typ, const uint8_t *wire)>;
+
+    struct Call {
+        uint32_t oid;
+        Pending handler;
+    };
+
+    void receive() {
+        std::vector<uint8_t> frame;
+        while (transport.recv(frame)) {
+            for_each_record(frame, [this](uint32_t typ, const uint8_t *wire, const trailer_datatype &trailer) {
+                Call call;
+                if (!pending.take(trailer.seq, call)) {
+                    fprintf(stderr, "closure rpc: response to unknown call %u\n", trailer.seq);
+                    return;
+                }
+                if (call.oid != trailer.oid)
+                    fprintf(stderr, "closure rpc: response to call %u for object %u, expected %u\n",
+                            trailer.seq, trailer.oid, call.oid);
+                call.handler(typ, wire);
+            });
+        }
+        fail_pending();
+    }
+
+    // No response comes once the transport is closed
+    void fail_pending() {
+        closed.store(true);
+        pending.drain([](Call &call) { call.handler(0, nullptr); });
+    }
+
+    Transport &transport;
+    Batcher batcher;
+    std::atomic<uint32_t> next_seq { 1 };
+    std::atomic<bool> closed { false };
+    ShardedMap<uint32_t, Call> pending;
+    std::thread receiver;
+};
+
+/*
+ * Slave side
+ */
+
+class RpcSlave
+{
+public:
+    RpcSlave(Transport &transport, unsigned workers)
+        : transport(transport), batcher(transport), queues(workers ? workers : 1) {
+    }
+
+    // Registers the handler of a request type; before run()
+    template <typename Request>
+    void handle(uint32_t typ, std::function<void(const Request &)> handler) {
+        handlers[typ] = [handler](const uint8_t *wire) {
+            Request request;
+            codec::decode(wire, request);
+            handler(request);
+        };
+    }
+
+    // Answers the call of request; the trailer is filled in
+    template <typename Response, typename Request>
+    void reply(const Request &request, uint32_t typ, Response response) {
+        response.trailer = request.trailer;
+        response.trailer.mid = uint16_t(typ);
+        batcher.post(typ, response);
+    }
+
+    // Fails the call of request with RemoteError on the master
+    template <typename Request>
+    void fail(const Request &request, int32_t status) {
+        okay_datatype okay;
+        okay.x = status;
+        reply(request, DATA_TYP_OKAY, okay);
+    }
+
+    // Dispatches requests until the transport is shut down
+    void run() {
+        std::vector<std::thread> threads;
+        for (Queue &queue : queues)
+            threads.emplace_back([this, &queue]() { work(queue); });
+
+        std::vector<uint8_t> frame;
+        while (transport.recv(frame)) {
+            for_each_record(frame, [this](uint32_t typ, const uint8_t *wire, const trailer_datatype &trailer) {
+                Queue &queue = queues[trailer.oid % queues.size()];
+                Record record { typ, {} };
+                std::memcpy(record.wire, wire, codec::message_size(typ));
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.records.push_back(record);
+            });
+            for (Queue &queue : queues)
+                queue.ready.notify_one();
+        }
+
+        for (Queue &queue : queues) {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.stopped = true;
+            queue.ready.notify_one();
+        }
+        for (std::thread &thread : threads)
+            thread.join();
+    }
+
+    double batch_size() { return batcher.batch_size(); }
+
+private:
+    struct Record {
+        uint32_t typ;
+        uint8_t wire[codec::max_message_size];
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::vector<Record> records;
+        bool stopped = false;
+    };
+
+    void work(Queue &queue) {
+        std::vector<Record> records;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(queue.mutex);
+                queue.ready.wait(lock, [&]() { return !queue.records.empty() || queue.stopped; });
+                if (queue.records.empty())
+                    return;
+                records.swap(queue.records);
+            }
+
+            // the responses to the requests taken together go out together,
+            // independently of the other workers
+            batcher.hold();
+            for (const Record &record : records) {
+                auto it = handlers.find(record.typ);
+                if (it == handlers.end()) {
+                    fprintf(stderr, "closure rpc: no handler for request type %u\n", record.typ);
+                    okay_datatype request;
+                    codec::decode(record.wire + codec::message_size(record.typ) - sizeof(trailer_datatype),
+                                  request.trailer);
+                    fail(request, -1);
+                    continue;
+                }
+                it->second(record.wire);
+            }
+            batcher.release();
+            records.clear();
+        }
+    }
+
+    Transport &transport;
+    Batcher batcher;
+    std::unordered_map<uint32_t, std::function<void(const uint8_t *)>> handlers;
+    std::vector<Queue> queues;
+};
+
+} // namespace closure
@@ -0,0 +1,283 @@
+/*******************************************************************************
+ * Shared-memory transport between the two sides of a partition on one
+ * Linux host, standing in for the cross-domain guard
+ *
+ * A POSIX shared-memory segment holds two single-consumer rings of frames,
+ * one per direction. A frame is written as a 8-byte header (length) and its
+ * payload, padded to 8 bytes; a frame that would cross the end of the ring
+ * is preceded by a wrap marker. Senders are serialized in the process by a
+ * mutex. Readers and writers spin briefly and then sleep on a futex, so an
+ * idle side costs no CPU.
+ *
+ * Each side records its pid in the segment. The channel counts as closed
+ * once either side shuts it down or the process of the other side is gone,
+ * so that neither waits forever on a peer that died.
+ *******************************************************************************/
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ClosureRpc.hpp"
+
+namespace closure {
+
+namespace shm {
+
+// A futex-based event in shared memory
+struct alignas(64) Event {
+    std::atomic<uint32_t> seq;
+    std::atomic<uint32_t> waiters;
+
+    void notify() {
+        seq.fetch_add(1);
+        if (waiters.load())
+            syscall(SYS_futex, &seq, FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+    }
+
+    // Waits until ready() or closed(); the timeout only bounds a lost close
+    template <typename Ready, typename Closed>
+    bool wait(Ready ready, Closed closed) {
+        for (int spin = 0; spin < 2000; spin++) {
+            if (ready())
+                return true;
+            if (spin > 100)
+                std::this_thread::yield();
+        }
+        while (true) {
+            waiters.fetch_add(1);
+            uint32_t observed = seq.load();
+            if (ready() || closed()) {
+                waiters.fetch_sub(1);
+                return ready();
+            }
+            timespec timeout = { 0, 100 * 1000 * 1000 };
+            syscall(SYS_futex, &seq, FUTEX_WAIT, observed, &timeout, nullptr, 0);
+            waiters.fetch_sub(1);
+        }
+    }
+};
+
+struct alignas(64) Ring {
+    alignas(64) std::atomic<uint64_t> head;   // bytes written
+    alignas(64) std::atomic<uint64_t> tail;   // bytes read
+    Event readable;
+    Event writable;
+};
+
+struct Segment {
+    std::atomic<uint64_t> ready;              // READY once the creator has set it up
+    uint64_t capacity;                        // of each ring, a power of two
+    std::atomic<uint32_t> closed;
+    std::atomic<pid_t> pids[2];               // of each side, 0 until it attaches
+    Ring rings[2];
+};
+
+constexpr uint64_t READY = 0x434c4f5355524532;  // "CLOSURE2"
+constexpr uint32_t WRAP = 0xffffffff;
+constexpr size_t HEADER = 8;
+
+inline size_t pad(size_t len) { return (len + 7) & ~size_t(7); }
+
+inline bool alive(pid_t pid) { return kill(pid, 0) == 0 || errno == EPERM; }
+
+} // namespace shm
+
+class ShmChannel : public Transport
+{
+public:
+    enum Side { MASTER = 0, SLAVE = 1 };
+
+    // The slave creates the channel, the master opens it. The master attaches
+    // only once the slave has sized the segment and published it as ready,
+    // and skips a segment left behind by a slave that is gone or that the
+    // last master closed, until the new slave replaces it.
+    ShmChannel(const std::string &name, Side side, bool create, size_t capacity = 1 << 20)
+        : name(name), side(side), owner(create) {
+        if (capacity & (capacity - 1))
+            throw std::invalid_argument("ring capacity must be a power of two");
+
+        if (create) {
+            shm_unlink(name.c_str());
+            int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if (fd < 0)
+                throw std::runtime_error("shm_open " + name + ": " + strerror(errno));
+            size = sizeof(shm::Segment) + 2 * capacity;
+            if (ftruncate(fd, size) < 0) {
+                close(fd);
+                throw std::runtime_error("ftruncate " + name + ": " + strerror(errno));
+            }
+            map(fd);
+
+            // a new segment is zero-filled, which is the empty state of the
+            // rings; ready is written last, so capacity and the pid are set
+            // once the master sees it
+            segment->capacity = capacity;
+            segment->pids[side].store(getpid());
+            segment->ready.store(shm::READY, std::memory_order_release);
+        } else {
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+            while (!attach()) {
+                if (std::chrono::steady_clock::now() > deadline)
+                    throw std::runtime_error("attach " + name + ": timed out");
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            segment->pids[side].store(getpid());
+        }
+
+        uint8_t *data = reinterpret_cast<uint8_t *>(segment) + sizeof(shm::Segment);
+        out = &segment->rings[side];
+        in = &segment->rings[1 - side];
+        out_data = data + side * segment->capacity;
+        in_data = data + (1 - side) * segment->capacity;
+    }
+
+    ~ShmChannel() override {
+        munmap(segment, size);
+        if (owner)
+            shm_unlink(name.c_str());
+    }
+
+    bool send(const void *frame, size_t len) override {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        const uint64_t capacity = segment->capacity;
+        const size_t need = shm::HEADER + shm::pad(len);
+        if (need > capacity / 2)
+            throw std::length_error("frame larger than half the ring");
+
+        uint64_t head = out->head.load(std::memory_order_relaxed);
+        size_t until_end = capacity - (head & (capacity - 1));
+        size_t skip = until_end < need ? until_end : 0;
+
+        bool ready = out->writable.wait(
+            [&]() { return head + skip + need - out->tail.load(std::memory_order_acquire) <= capacity; },
+            [&]() { return closed(); });
+        if (!ready)
+            return false;
+
+        if (skip) {
+            write_header(head, shm::WRAP);
+            head += skip;
+        }
+        write_header(head, len);
+        std::memcpy(out_data + ((head + shm::HEADER) & (capacity - 1)), frame, len);
+        out->head.store(head + need, std::memory_order_release);
+        out->readable.notify();
+        return true;
+    }
+
+    bool recv(std::vector<uint8_t> &frame) override {
+        const uint64_t capacity = segment->capacity;
+        while (true) {
+            uint64_t tail = in->tail.load(std::memory_order_relaxed);
+            bool ready = in->readable.wait(
+                [&]() { return in->head.load(std::memory_order_acquire) != tail; },
+                [&]() { return closed(); });
+            if (!ready)
+                return false;
+
+            uint32_t len;
+            std::memcpy(&len, in_data + (tail & (capacity - 1)), sizeof(len));
+            if (len == shm::WRAP) {
+                in->tail.store(tail + capacity - (tail & (capacity - 1)), std::memory_order_release);
+                continue;
+            }
+
+            frame.resize(len);
+            std::memcpy(frame.data(), in_data + ((tail + shm::HEADER) & (capacity - 1)), len);
+            in->tail.store(tail + shm::HEADER + shm::pad(len), std::memory_order_release);
+            in->writable.notify();
+            return true;
+        }
+    }
+
+    // Wakes both sides; frames already in the rings are still delivered
+    void shutdown() override {
+        segment->closed.store(1);
+        for (shm::Ring &ring : segment->rings) {
+            ring.readable.notify();
+            ring.writable.notify();
+        }
+    }
+
+private:
+    void map(int fd) {
+        void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED)
+            throw std::runtime_error("mmap " + name + ": " + strerror(errno));
+        segment = static_cast<shm::Segment *>(base);
+    }
+
+    // Maps the segment if the slave has created, sized and published it
+    // and is still running it; false to try again
+    bool attach() {
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            if (errno == ENOENT)
+                return false;
+            throw std::runtime_error("shm_open " + name + ": " + strerror(errno));
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(shm::Segment)) {
+            close(fd);
+            return false;
+        }
+        size = st.st_size;
+        map(fd);
+
+        if (segment->ready.load(std::memory_order_acquire) == shm::READY &&
+            !segment->closed.load() && shm::alive(segment->pids[1 - side].load())) {
+            if (size != sizeof(shm::Segment) + 2 * segment->capacity) {
+                munmap(segment, size);
+                throw std::runtime_error("shm segment " + name + ": unexpected size");
+            }
+            return true;
+        }
+        munmap(segment, size);
+        return false;
+    }
+
+    // shut down by either side, or the other side is gone
+    bool closed() {
+        if (segment->closed.load() != 0)
+            return true;
+        pid_t peer = segment->pids[1 - side].load();
+        return peer != 0 && !shm::alive(peer);
+    }
+
+    void write_header(uint64_t pos, uint32_t len) {
+        uint8_t header[shm::HEADER] = {};
+        std::memcpy(header, &len, sizeof(len));
+        std::memcpy(out_data + (pos & (segment->capacity - 1)), header, sizeof(header));
+    }
+
+    std::string name;
+    Side side;
+    bool owner;
+    size_t size;
+    shm::Segment *segment;
+    shm::Ring *out, *in;
+    uint8_t *out_data, *in_data;
+    std::mutex send_mutex;
+};
+
+} // namespace closure
@@ -0,0 +1,94 @@
+/*******************************************************************************
+ * Microbenchmark of codec.hpp against the C codec
+ *
+ * For every message type, encodes and decodes a batch of messages with
+ *   c      the *_data_encode() and *_data_decode() functions of codec.c
+ *   scalar closure::codec::encode()/decode() of one message
+ *   batch  closure::codec::encode()/decode() of the whole batch
+ * and prints nanoseconds per message.
+ *******************************************************************************/
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "codec.hpp"
+
+using namespace std;
+
+typedef void (*CCodec)(void *buff_out, void *buff_in, size_t *len);
+
+static volatile uint8_t sink;
+
+template <typename F>
+static double time_ns(size_t messages, int rounds, F f)
+{
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+        f();
+    chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count() / (double(messages) * rounds);
+}
+
+template <typename Message>
+static void bench(const char *name, CCodec c_encode, CCodec c_decode, size_t n, int rounds)
+{
+    vector<Message> messages(n), decoded(n);
+    vector<uint8_t> wire(n * sizeof(Message));
+    uint8_t *bytes = reinterpret_cast<uint8_t *>(messages.data());
+    for (size_t i = 0; i < n * sizeof(Message); i++)
+        bytes[i] = uint8_t(rand());
+
+    double c_enc = time_ns(n, rounds, [&]() {
+        size_t len;
+        for (size_t i = 0; i < n; i++)
+            c_encode(&wire[i * sizeof(Message)], &messages[i], &len);
+        sink = wire[0];
+    });
+    double c_dec = time_ns(n, rounds, [&]() {
+        size_t len;
+        for (size_t i = 0; i < n; i++)
+            c_decode(&decoded[i], &wire[i * sizeof(Message)], &len);
+        sink = reinterpret_cast<uint8_t *>(decoded.data())[0];
+    });
+    double scalar_enc = time_ns(n, rounds, [&]() {
+        for (size_t i = 0; i < n; i++)
+            closure::codec::encode(messages[i], &wire[i * sizeof(Message)]);
+        sink = wire[0];
+    });
+    double scalar_dec = time_ns(n, rounds, [&]() {
+        for (size_t i = 0; i < n; i++)
+            closure::codec::decode(&wire[i * sizeof(Message)], decoded[i]);
+        sink = reinterpret_cast<uint8_t *>(decoded.data())[0];
+    });
+    double batch_enc = time_ns(n, rounds, [&]() {
+        closure::codec::encode(messages.data(), n, wire.data());
+        sink = wire[0];
+    });
+    double batch_dec = time_ns(n, rounds, [&]() {
+        closure::codec::decode(wire.data(), n, decoded.data());
+        sink = reinterpret_cast<uint8_t *>(decoded.data())[0];
+    });
+
+    printf("%-36s %4zu %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f\n", name, sizeof(Message),
+           c_enc, scalar_enc, batch_enc, c_dec, scalar_dec, batch_dec);
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 4096;
+    int rounds = argc > 2 ? atoi(argv[2]) : 2000;
+
+    printf("%zu messages x %d rounds, ns/message\n", n, rounds);
+    printf("%-36s %4s %8s %8s %8s %8s %8s %8s\n", "type", "size",
+           "c enc", "enc", "batch", "c dec", "dec", "batch");
+    bench<nextrpc_datatype>("nextrpc_datatype", nextrpc_data_encode, nextrpc_data_decode, n, rounds);
+    bench<okay_datatype>("okay_datatype", okay_data_encode, okay_data_decode, n, rounds);
+    bench<request_extraconstructor_datatype>("request_extraconstructor_datatype",
+        request_extraconstructor_data_encode, request_extraconstructor_data_decode, n, rounds);
+    bench<request_extragetvalue_datatype>("request_extragetvalue_datatype",
+        request_extragetvalue_data_encode, request_extragetvalue_data_decode, n, rounds);
+    bench<response_eaxtragetvalueret_datatype>("response_eaxtragetvalueret_datatype",
+        response_eaxtragetvalueret_data_encode, response_eaxtragetvalueret_data_decode, n, rounds);
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*******************************************************************************
+ * Round-trip tests of codec.hpp against the C codec, for every type in
+ * example2.idl and the trailer
+ *******************************************************************************/
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "codec.hpp"
+
+using namespace std;
+
+static int failures = 0;
+
+#define CHECK(cond, what) \
+    do { if (!(cond)) { fprintf(stderr, "FAIL %s: %s\n", name, what); failures++; } } while (0)
+
+static mt19937_64 rng(2024);
+
+// memcmp() must not be passed the null data() of an empty vector, even for
+// zero bytes
+static bool same_bytes(const void *a, const void *b, size_t size)
+{
+    const uint8_t *first = static_cast<const uint8_t *>(a);
+    return equal(first, first + size, static_cast<const uint8_t *>(b));
+}
+
+template <typename Message>
+static Message random_message()
+{
+    Message message;
+    uint8_t *bytes = reinterpret_cast<uint8_t *>(&message);
+    for (size_t i = 0; i < sizeof(Message); i++)
+        bytes[i] = uint8_t(rng());
+    return message;
+}
+
+typedef void (*CCodec)(void *buff_out, void *buff_in, size_t *len);
+
+template <typename Message>
+static void test(const char *name, CCodec c_encode, CCodec c_decode)
+{
+    // single message: same bytes as the C codec, and back
+    for (int round = 0; round < 1000; round++) {
+        Message message = random_message<Message>();
+        uint8_t expected[sizeof(Message)];
+        uint8_t wire[sizeof(Message)];
+        size_t len_out = 0;
+        c_encode(expected, &message, &len_out);
+
+        CHECK(closure::codec::encode(message, wire) == len_out, "encoded length");
+        CHECK(memcmp(wire, expected, sizeof(Message)) == 0, "encoded bytes");
+
+        Message decoded, c_decoded;
+        closure::codec::decode(wire, decoded);
+        c_decode(&c_decoded, wire, &len_out);
+        CHECK(memcmp(&decoded, &message, sizeof(Message)) == 0, "decode(encode(m))");
+        CHECK(memcmp(&decoded, &c_decoded, sizeof(Message)) == 0, "decoded like the C codec");
+
+        Message in_place = message;
+        closure::codec::convert_in_place(in_place);
+        CHECK(memcmp(&in_place, expected, sizeof(Message)) == 0, "in-place encode");
+        closure::codec::convert_in_place(in_place);
+        CHECK(memcmp(&in_place, &message, sizeof(Message)) == 0, "in-place round trip");
+    }
+
+    // batches of every size around the vector/scalar boundary
+    for (size_t n = 0; n <= 40; n++) {
+        vector<Message> messages(n);
+        vector<uint8_t> expected(n * sizeof(Message));
+        for (size_t i = 0; i < n; i++) {
+            size_t len_out;
+            messages[i] = random_message<Message>();
+            c_encode(&expected[i * sizeof(Message)], &messages[i], &len_out);
+        }
+
+        // one spare byte to catch writes past the end
+        vector<uint8_t> wire(n * sizeof(Message) + 1, 0xa5);
+        CHECK(closure::codec::encode(messages.data(), n, wire.data()) == n * sizeof(Message),
+              "batch length");
+        CHECK(equal(expected.begin(), expected.end(), wire.begin()), "batch bytes");
+        CHECK(wire.back() == 0xa5, "batch overrun");
+
+        vector<Message> decoded(n);
+        closure::codec::decode(wire.data(), n, decoded.data());
+        CHECK(same_bytes(decoded.data(), messages.data(), n * sizeof(Message)), "batch round trip");
+
+        vector<Message> in_place = messages;
+        closure::codec::encode(in_place.data(), n, in_place.data());
+        CHECK(same_bytes(in_place.data(), expected.data(), n * sizeof(Message)), "batch in place");
+    }
+
+    printf("%-36s ok\n", name);
+}
+
+// The trailer has no C codec of its own; it is encoded as part of every message
+static void test_trailer()
+{
+    const char *name = "trailer_datatype";
+    trailer_datatype trailer = { 0x01020304, 0x05060708, 0x090a0b0c, 0x0d0e, 0x0f10 };
+    const uint8_t expected[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    uint8_t wire[sizeof(trailer_datatype)];
+
+    CHECK(closure::codec::encode(trailer, wire) == sizeof(expected), "encoded length");
+    CHECK(memcmp(wire, expected, sizeof(expected)) == 0, "encoded bytes");
+
+    trailer_datatype decoded;
+    closure::codec::decode(wire, decoded);
+    CHECK(memcmp(&decoded, &trailer, sizeof(trailer)) == 0, "decode(encode(m))");
+
+    printf("%-36s ok\n", name);
+}
+
+int main()
+{
+    test_trailer();
+    test<nextrpc_datatype>("nextrpc_datatype", nextrpc_data_encode, nextrpc_data_decode);
+    test<okay_datatype>("okay_datatype", okay_data_encode, okay_data_decode);
+    test<request_extraconstructor_datatype>("request_extraconstructor_datatype",
+        request_extraconstructor_data_encode, request_extraconstructor_data_decode);
+    test<request_extragetvalue_datatype>("request_extragetvalue_datatype",
+        request_extragetvalue_data_encode, request_extragetvalue_data_decode);
+    test<response_eaxtragetvalueret_datatype>("response_eaxtragetvalueret_datatype",
+        response_eaxtragetvalueret_data_encode, response_eaxtragetvalueret_data_decode);
+
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+/*******************************************************************************
+ * Throughput/latency benchmark of the example2 RPC runtime
+ *
+ * Forks a purple slave (the real Extra behind ClosureRemoteHalSlave) and
+ * drives it from the orange side over the shared-memory channel with
+ * Extra::getValue calls:
+ *   pipelined  one thread keeping C calls in flight, sent in batches
+ *   threads    C threads each making blocking calls, as the shadow Extra does
+ * C = 1 is the old one-call-per-round-trip behaviour.
+ *
+ *   ./rpc_bench [calls] [workers] [concurrency...]
+ *******************************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ClosureRemoteHalMaster.hpp"
+#include "ClosureRemoteHalSlave.hpp"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+static constexpr int OBJECTS = 64;
+
+struct Result {
+    double seconds;
+    vector<double> latencies;   // microseconds
+};
+
+static void report(const char *mode, int concurrency, Result &result)
+{
+    vector<double> &l = result.latencies;
+    sort(l.begin(), l.end());
+    printf("%-10s %5d %12.0f %10.1f %10.1f %10.1f\n", mode, concurrency,
+           l.size() / result.seconds, l[l.size() / 2], l[l.size() * 99 / 100], l.back());
+}
+
+static double micros(Clock::time_point from, Clock::time_point to)
+{
+    return chrono::duration<double, micro>(to - from).count();
+}
+
+static Result pipelined(const vector<int> &oids, int calls, int concurrency)
+{
+    Result result;
+    result.latencies.reserve(calls);
+    deque<pair<Clock::time_point, future<response_eaxtragetvalueret_datatype>>> window;
+
+    auto start = Clock::now();
+    int issued = 0;
+    while (issued < calls || !window.empty()) {
+        // refill the window with one frame of requests
+        if (issued < calls && (int) window.size() < concurrency) {
+            closure::RpcMaster::Batch batch(ClosureRemoteHalMaster::master());
+            for (; issued < calls && (int) window.size() < concurrency; issued++)
+                window.emplace_back(Clock::now(),
+                    ClosureRemoteHalMaster::invokeExtraGetValueAsync(oids[issued % oids.size()]));
+        }
+
+        // wait for the oldest call and take every other one already answered
+        do {
+            if (window.front().second.get().value != 42)
+                abort();
+            result.latencies.push_back(micros(window.front().first, Clock::now()));
+            window.pop_front();
+        } while (!window.empty() &&
+                 window.front().second.wait_for(chrono::seconds(0)) == future_status::ready);
+    }
+    result.seconds = chrono::duration<double>(Clock::now() - start).count();
+    return result;
+}
+
+static Result threads(const vector<int> &oids, int calls, int concurrency)
+{
+    vector<vector<double>> latencies(concurrency);
+    vector<thread> workers;
+
+    auto start = Clock::now();
+    for (int t = 0; t < concurrency; t++) {
+        workers.emplace_back([&, t]() {
+            for (int i = t; i < calls; i += concurrency) {
+                auto issued = Clock::now();
+                if (ClosureRemoteHalMaster::invokeExtraGetValue(oids[i % oids.size()]) != 42)
+                    abort();
+                latencies[t].push_back(micros(issued, Clock::now()));
+            }
+        });
+    }
+    for (thread &worker : workers)
+        worker.join();
+
+    Result result;
+    result.seconds = chrono::duration<double>(Clock::now() - start).count();
+    for (auto &l : latencies)
+        result.latencies.insert(result.latencies.end(), l.begin(), l.end());
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    int calls = argc > 1 ? atoi(argv[1]) : 200000;
+    unsigned workers = argc > 2 ? atoi(argv[2]) : 4;
+    vector<int> levels;
+    for (int i = 3; i < argc; i++)
+        levels.push_back(atoi(argv[i]));
+    if (levels.empty())
+        levels = { 1, 4, 16, 64, 256 };
+
+    // the slave creates the channel, so that the master sees it go if the
+    // slave dies
+    string name = "/closure-rpc-bench-" + to_string(getpid());
+    pid_t slave = fork();
+    if (slave == 0) {
+        {
+            closure::ShmChannel channel(name, closure::ShmChannel::SLAVE, true);
+            ClosureRemoteHalSlave server(channel, workers);
+            server.listen();
+            fprintf(stderr, "slave: %.1f responses per frame\n", server.batchSize());
+        }
+        _exit(0);
+    }
+
+    ClosureRemoteHalMaster::connect(
+        std::make_unique<closure::ShmChannel>(name, closure::ShmChannel::MASTER, false));
+
+    // constructors are pipelined too
+    vector<int> oids(OBJECTS);
+    vector<future<okay_datatype>> constructed;
+    for (int &oid : oids)
+        constructed.push_back(ClosureRemoteHalMaster::instantiateExtraAsync(oid));
+    for (auto &done : constructed)
+        done.get();
+
+    printf("%d calls, %u slave workers, %d objects\n", calls, workers, OBJECTS);
+    printf("%-10s %5s %12s %10s %10s %10s\n", "mode", "conc", "calls/s", "p50 us", "p99 us", "max us");
+    for (int concurrency : levels) {
+        Result result = pipelined(oids, calls, concurrency);
+        report("pipelined", concurrency, result);
+    }
+    for (int concurrency : levels) {
+        Result result = threads(oids, calls, concurrency);
+        report("threads", concurrency, result);
+    }
+    printf("master: %.1f requests per frame\n", ClosureRemoteHalMaster::master().batch_size());
+
+    ClosureRemoteHalMaster::disconnect();
+    waitpid(slave, nullptr, 0);
+    return 0;
+}
@@ -0,0 +1,8 @@
+#include "ClosureRemoteHalSlave.hpp"
+
+// @PurpleMain
+// Serves the orange side's calls on Extra
+int main()
+{
+  ClosureRemoteHalSlave::init();
+}
@@ -0,0 +1,284 @@
+"""
+End-to-end performance harness for the CAPO tools.
+
+Generates a synthetic C++ project of each requested size, with N classes,
+M annotated functions and global variables spread over K levels, and the
+matching topology.json. Each annotated declaration carries its label as a
+cle_annotate attribute, for the CLE plugin, and sits in a #pragma cle
+begin/end block, for the divider. The divider, clang with
+the CLE plugin and opt with ExtractDeclares are then run on it with their
+trace flags, and the per-phase times and peak RSS in the Chrome trace files
+they write are summed into one table per size.
+
+    export CLANG_14_EXECUTABLE=/usr/lib/llvm-14/bin/clang
+    export OPT_14_EXECUTABLE=/usr/lib/llvm-14/bin/opt
+    python3 bench/pipeline.py --sizes 100,1000,10000 --json results.json
+
+A tool is skipped when its binary or plugin is not found. Use --keep DIR to
+keep the projects and traces, which open in chrome://tracing or
+https://ui.perfetto.dev.
+"""
+
+import argparse
+import glob
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CAPO = os.path.dirname(HERE)
+CATEGORIES = ['parse', 'preprocess', 'match', 'rewrite', 'graph', 'export', 'io']
+
+
+def first(*patterns):
+    for pattern in patterns:
+        found = sorted(glob.glob(pattern))
+        if found:
+            return found[0]
+    return None
+
+
+def generate(root, classes, annotations, levels):
+    """Writes the project to root/src and returns the path of topology.json"""
+    src_dir = os.path.join(root, 'src')
+    os.makedirs(src_dir)
+
+    level_names = ['level%d' % i for i in range(levels)]
+    functions = []
+    global_scoped_vars = []
+
+    # annotation i goes to the class file i % classes; every file gets both
+    # kinds of annotation on every level
+    per_file = [[] for _ in range(classes)]
+    for i in range(annotations):
+        per_file[i % classes].append(i)
+
+    def kind(i):
+        return (i // classes) % 2
+
+    def level_of(i):
+        return level_names[(i // (2 * classes)) % levels]
+
+    for c in range(classes):
+        lines = ['#pragma cle def %s {"level":"%s"}' % (level.upper(), level)
+                 for level in level_names]
+        lines += ['',
+                  'class Class%d {' % c,
+                  '    int value;',
+                  'public:',
+                  '    Class%d(int v) : value(v) {}' % c,
+                  '    int get() const { return value; }',
+                  '    void add(int x) { value += x; }',
+                  '};',
+                  '']
+        for i in per_file[c]:
+            label = level_of(i).upper()
+            annotate = '__attribute__((cle_annotate("%s")))' % label
+            lines.append('#pragma cle begin %s' % label)
+            if kind(i) == 0:
+                name = 'func_%d' % i
+                lines += ['%s int %s(int x) {' % (annotate, name),
+                          '    Class%d object(x);' % c,
+                          '    object.add(%d);' % i,
+                          '    return object.get();',
+                          '}']
+                functions.append((i, name))
+            else:
+                name = 'var_%d' % i
+                lines.append('%s int %s = %d;' % (annotate, name, i))
+                global_scoped_vars.append((i, name))
+            lines.append('#pragma cle end %s' % label)
+            lines.append('')
+
+        with open(os.path.join(src_dir, 'class%d.cpp' % c), 'w') as f:
+            f.write('\n'.join(lines))
+
+    def annotation(i, name):
+        level = level_of(i)
+        return {'name': name, 'level': level, 'enclave': level + '_E', 'line': 0}
+
+    topology = {
+        'source_path': src_dir,
+        'enclaves': [],
+        'levels': level_names,
+        'functions': [annotation(i, name) for i, name in functions],
+        'global_scoped_vars': [annotation(i, name) for i, name in global_scoped_vars],
+    }
+    topology_json = os.path.join(root, 'topology.json')
+    with open(topology_json, 'w') as f:
+        json.dump(topology, f, indent=2)
+
+    return topology_json
+
+
+def sources(root):
+    return sorted(glob.glob(os.path.join(root, 'src', '*.cpp')))
+
+
+def timed(args, cwd):
+    start = time.perf_counter()
+    subprocess.run(args, cwd=cwd, check=True, stdout=subprocess.DEVNULL)
+    return time.perf_counter() - start
+
+
+def run_divider(divider, root, trace_dir):
+    args = [divider, '--output-dir', os.path.join(root, 'divided'),
+            '-incremental=false', '--trace', os.path.join(trace_dir, 'divider-%p.json'),
+            os.path.join(root, 'topology.json'), '--']
+    return timed(args, root)
+
+
+def run_plugin(clang, plugin, root, trace_dir):
+    work_dir = os.path.join(root, 'graph')
+    os.makedirs(work_dir)
+    wall = 0.0
+    for source in sources(root):
+        args = [clang, '-g', '-c', '-o', os.devnull,
+                '-Xclang', '-load', '-Xclang', plugin,
+                '-Xclang', '-plugin', '-Xclang', 'cle',
+                '-Xclang', '-plugin-arg-cle', '-Xclang', 'shard-dir=' + os.path.join(work_dir, 'shards'),
+                '-Xclang', '-plugin-arg-cle', '-Xclang', 'trace=' + os.path.join(trace_dir, 'cle-%p.json'),
+                source]
+        wall += timed(args, work_dir)
+    return wall
+
+
+def run_extract_declares(clang, opt, plugin, root, trace_dir):
+    work_dir = os.path.join(root, 'declares')
+    os.makedirs(work_dir)
+    wall = 0.0
+    for source in sources(root):
+        ll = os.path.join(work_dir, os.path.basename(source)[:-4] + '.ll')
+        subprocess.run([clang, '-g', '-O0', '-S', '-Wno-unknown-attributes', '-emit-llvm',
+                        '-o', ll, source], check=True)
+        # -load registers -declare-csv-trace before opt parses its options
+        args = [opt, '-disable-output', '-load=' + plugin, '-load-pass-plugin=' + plugin,
+                '-passes=declare-csv', '-declare-csv-trace=' + os.path.join(trace_dir, 'declare-csv-%p.json'),
+                ll]
+        wall += timed(args, work_dir)
+    return wall
+
+
+def self_times(events):
+    """The duration of each complete event less that of the events nested in
+    it on the same thread, so that nested phases are not counted twice.
+    An event summing many pieces (args.pieces) is taken out of the event it
+    was recorded in but is never a parent itself, as it is not a real
+    interval."""
+    threads = {}
+    for event in events:
+        threads.setdefault((event['pid'], event['tid']), []).append(event)
+
+    times = []
+    for thread in threads.values():
+        # parents first, then by start
+        thread.sort(key=lambda e: (e['ts'], -e['dur']))
+        open_events = []
+        for event in thread:
+            end = event['ts'] + event['dur']
+            while open_events and open_events[-1][0]['ts'] + open_events[-1][0]['dur'] < end:
+                open_events.pop()
+            entry = [event, event['dur']]
+            times.append(entry)
+            if open_events:
+                open_events[-1][1] -= event['dur']
+            if not event.get('args', {}).get('pieces'):
+                open_events.append(entry)
+    return [(event, max(0, time)) for event, time in times]
+
+
+def summarize(trace_dir, prefix, wall):
+    """Sums the traces of one tool: self milliseconds per category and peak RSS"""
+    totals = dict.fromkeys(CATEGORIES, 0.0)
+    rss = 0
+    for path in glob.glob(os.path.join(trace_dir, prefix + '-*.json')):
+        with open(path) as f:
+            trace = json.load(f)
+        events = [e for e in trace['traceEvents'] if e['ph'] == 'X']
+        for event, time in self_times(events):
+            if event['cat'] in totals:
+                totals[event['cat']] += time / 1000.0
+        rss = max(rss, trace['otherData']['peak_rss_kb'])
+    return {'wall_ms': wall * 1000.0, 'phases_ms': totals, 'peak_rss_kb': rss}
+
+
+def print_table(size, results):
+    print('%d annotations, %d classes, %d levels' % (size['annotations'], size['classes'], size['levels']))
+    print('%-12s %10s' % ('tool', 'wall ms') +
+          ''.join(' %10s' % c for c in CATEGORIES) + ' %10s' % 'peak MB')
+    for tool, result in results.items():
+        print('%-12s %10.1f' % (tool, result['wall_ms']) +
+              ''.join(' %10.1f' % result['phases_ms'][c] for c in CATEGORIES) +
+              ' %10.1f' % (result['peak_rss_kb'] / 1024.0))
+    print()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='CAPO end-to-end performance harness')
+    parser.add_argument('--sizes', default='100,1000,10000',
+                        help='comma separated numbers of annotated functions and globals')
+    parser.add_argument('--classes', type=int, default=0,
+                        help='classes (one source file each); default annotations / 100, at least 1')
+    parser.add_argument('--levels', type=int, default=2)
+    parser.add_argument('--divider', default=first(os.path.join(CAPO, 'divider', 'build', 'bin', 'divider')))
+    parser.add_argument('--plugin', default=first(os.path.join(CAPO, 'clang-plugin', 'build', 'CLE.*')))
+    parser.add_argument('--extract-declares',
+                        default=first(os.path.join(CAPO, 'extract_declares', 'build', 'ExtractDeclares.*')))
+    parser.add_argument('--clang', default=os.environ.get('CLANG_14_EXECUTABLE', shutil.which('clang')))
+    parser.add_argument('--opt', default=os.environ.get('OPT_14_EXECUTABLE', shutil.which('opt')))
+    parser.add_argument('--json', help='also write the results to this file')
+    parser.add_argument('--keep', help='generate the projects and traces under this directory')
+    args = parser.parse_args()
+
+    def usable(name, *paths):
+        if all(path and os.path.exists(path) for path in paths):
+            return True
+        print('skipping %s: not found' % name, file=sys.stderr)
+        return False
+
+    use_divider = usable('divider', args.divider)
+    use_plugin = usable('CLE plugin', args.clang, args.plugin)
+    use_declares = usable('ExtractDeclares', args.clang, args.opt, args.extract_declares)
+
+    base = args.keep or tempfile.mkdtemp()
+    report = []
+    try:
+        for annotations in (int(s) for s in args.sizes.split(',')):
+            size = {'annotations': annotations,
+                    'classes': args.classes or max(1, annotations // 100),
+                    'levels': args.levels}
+            root = os.path.join(base, 'project-%d' % annotations)
+            shutil.rmtree(root, ignore_errors=True)
+            generate(root, size['classes'], annotations, args.levels)
+            trace_dir = os.path.join(root, 'traces')
+            os.makedirs(trace_dir)
+
+            results = {}
+            if use_divider:
+                wall = run_divider(os.path.abspath(args.divider), root, trace_dir)
+                results['divider'] = summarize(trace_dir, 'divider', wall)
+            if use_plugin:
+                wall = run_plugin(args.clang, os.path.abspath(args.plugin), root, trace_dir)
+                results['cle'] = summarize(trace_dir, 'cle', wall)
+            if use_declares:
+                wall = run_extract_declares(args.clang, args.opt, os.path.abspath(args.extract_declares),
+                                            root, trace_dir)
+                results['declare-csv'] = summarize(trace_dir, 'declare-csv', wall)
+
+            print_table(size, results)
+            report.append(dict(size, tools=results))
+    finally:
+        if not args.keep:
+            shutil.rmtree(base)
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(report, f, indent=2)
+
+
+if __name__ == '__main__':
+    main()
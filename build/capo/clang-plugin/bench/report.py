@@ -0,0 +1,95 @@
+"""
+Memory/time report for the CLE clang plugin.
+
+Runs clang with each given plugin on every input (by default the programs
+in ../tests/cpp) and reports the wall time and peak RSS of the clang
+process. With two plugins, e.g. one built before and one after a change,
+it also checks that both wrote the same nodes.csv, edges.csv and
+collated.json, and exits with status 1 if they did not.
+
+    export CLANG_14_EXECUTABLE=/usr/lib/llvm-14/bin/clang
+    python3 bench/report.py /tmp/CLE-before.so build/CLE.so
+"""
+
+import argparse
+import filecmp
+import glob
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_INPUTS = sorted(glob.glob(os.path.join(HERE, '..', '..', 'tests', 'cpp', '*.cpp')))
+OUTPUTS = ['nodes.csv', 'edges.csv', 'collated.json']
+
+
+def run_plugin(clang, plugin, source, work_dir):
+    os.makedirs(work_dir)
+    args = [clang, '-g', '-c', '-o', os.devnull,
+            '-Xclang', '-load', '-Xclang', plugin,
+            '-Xclang', '-plugin', '-Xclang', 'cle', source]
+
+    start = time.perf_counter()
+    proc = subprocess.Popen(args, cwd=work_dir)
+    _, status, usage = os.wait4(proc.pid, 0)
+    elapsed = time.perf_counter() - start
+    if status != 0:
+        raise RuntimeError('clang failed on ' + source)
+
+    # ru_maxrss is in kilobytes on Linux
+    return elapsed, usage.ru_maxrss
+
+
+def main():
+    parser = argparse.ArgumentParser(description='CLE plugin memory/time report')
+    parser.add_argument('plugins', nargs='+', help='one or two plugin shared objects')
+    parser.add_argument('--inputs', nargs='*', default=DEFAULT_INPUTS)
+    parser.add_argument('--runs', type=int, default=3)
+    parser.add_argument('--clang', default=os.environ.get('CLANG_14_EXECUTABLE', 'clang'))
+    args = parser.parse_args()
+
+    plugins = [os.path.abspath(p) for p in args.plugins]
+    work = tempfile.mkdtemp()
+    differences = 0
+    try:
+        header = '| input |'
+        for p in plugins:
+            name = os.path.basename(p)
+            header += ' %s time (ms) | %s peak RSS (MB) |' % (name, name)
+        print(header)
+        print('|---' * (1 + 2 * len(plugins)) + '|')
+
+        for source in args.inputs:
+            line = '| %s |' % os.path.basename(source)
+            for i, plugin in enumerate(plugins):
+                times, rss = [], []
+                for r in range(args.runs):
+                    t, m = run_plugin(args.clang, plugin, os.path.abspath(source),
+                                      os.path.join(work, os.path.basename(source), str(i), str(r)))
+                    times.append(t)
+                    rss.append(m)
+                line += ' %.1f | %.1f |' % (min(times) * 1000, max(rss) / 1024)
+            print(line)
+
+            if len(plugins) == 2:
+                base = os.path.join(work, os.path.basename(source))
+                for out in OUTPUTS:
+                    if not filecmp.cmp(os.path.join(base, '0', '0', out),
+                                       os.path.join(base, '1', '0', out), shallow=False):
+                        print('  %s differs for %s' % (out, source))
+                        differences += 1
+    finally:
+        shutil.rmtree(work)
+
+    if len(plugins) == 2:
+        if differences:
+            print('%d outputs differ' % differences)
+            sys.exit(1)
+        print('all outputs identical')
+
+
+if __name__ == '__main__':
+    main()
@@ -10,6 +10,8 @@ namespace cle {
 using NodeID = size_t;
 using EdgeID = size_t;
 
+// IDs are dense and handed out in insertion order, so nodes and edges
+// are stored contiguously and an ID is the index into its vector.
 template<typename Node, typename Edge>
 class Graph {
 public:
@@ -23,33 +25,37 @@ public:
     }
 
     virtual NodeID add_node(Node&& node) {
-        nodes.insert(std::pair<NodeID, Node>(cur_node_id, node));
-        cur_node_id++;
-        return cur_node_id - 1;
+        nodes.push_back(std::move(node));
+        return nodes.size() - 1;
     }
 
-    void replace_node(NodeID id, Node node) {
-        nodes.insert_or_assign(id, node);
+    virtual void replace_node(NodeID id, Node node) {
+        nodes.at(id) = node;
     }
 
-    void replace_edge(EdgeID id, Edge edge) {
-        edges.insert_or_assign(id, edge);
+    virtual void replace_edge(EdgeID id, Edge edge) {
+        edges.at(id) = edge;
     }
 
-    EdgeID add_edge(Edge&& edge) {
-        edges.insert(std::pair<EdgeID, Edge>(cur_edge_id, edge));
-        cur_edge_id++;
-        return cur_edge_id - 1;
+    virtual EdgeID add_edge(Edge&& edge) {
+        edges.push_back(std::move(edge));
+        return edges.size() - 1;
+    }
+
+    size_t node_count() const {
+        return nodes.size();
+    }
+
+    size_t edge_count() const {
+        return edges.size();
     }
 
     virtual ~Graph() {}
 
 protected:
-    NodeID cur_node_id = 0;
-    EdgeID cur_edge_id = 0;
-    std::map<NodeID, Node> nodes;
-    std::map<EdgeID, Edge> edges;
+    std::vector<Node> nodes;
+    std::vector<Edge> edges;
 
 };
 
-};
\ No newline at end of file
+};
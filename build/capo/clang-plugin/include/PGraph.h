@@ -8,6 +8,8 @@
 #include "clang/AST/Attr.h"
 #include "clang/Analysis/CFG.h"
 #include "clang/Basic/SourceManager.h"
+#include "clang/Index/USRGeneration.h"
+#include "llvm/ADT/DenseMap.h"
 
 namespace cle {
 namespace pgraph {
@@ -241,10 +243,14 @@ public:
         std::string,                                // param idx
         std::string, unsigned int, unsigned int>;   // filename, start offset, end offset
     using EdgeTable = Table<EdgeID, std::string, NodeID, NodeID>;
+    using DeclTable = Table<NodeID, unsigned int, std::string>;   // is definition, USR
     NodeTable node_table();
     EdgeTable edge_table();
+    DeclTable decl_table();
 
     NodeID add_node(Node&& node) override;
+    EdgeID add_edge(Edge&& edge) override;
+    void replace_node(NodeID id, Node node) override;
 private:
 
     NodeID add_var_decl(VarDecl* decl, NodeCtx ctx = NodeCtx()); 
@@ -266,8 +272,19 @@ private:
     NodeID add_this_stmt(CXXThisExpr* stmt, NodeCtx ctx = NodeCtx());
     NodeID add_member_stmt(MemberExpr* stmt, NodeCtx ctx = NodeCtx());
 
-    std::map<NodeID, NodeID> reorder_nodes();
-    std::map<EdgeID, EdgeID> reorder_edges();
+    // Output IDs, 1-based and grouped by kind, indexed by graph ID. 
+    // Computed once by renumber() and shared by both tables.
+    struct Numbering {
+        std::vector<NodeID> node_ids;
+        std::vector<EdgeID> edge_ids;
+        std::vector<NodeID> node_order;     // graph IDs in output order
+        std::vector<EdgeID> edge_order;
+    };
+    std::optional<Numbering> numbering;
+    const Numbering& renumber();
+
+    std::vector<NodeID> reorder_nodes();
+    std::vector<EdgeID> reorder_edges();
     std::optional<NodeID> find_node(NamedDecl* decl);
 
     template<typename ClangDecl, typename CLENode> 
@@ -275,9 +292,12 @@ private:
 
     void add_implicit_destructors(Decl* decl, Stmt* body, NodeCtx ctx = NodeCtx());
 
-    std::map<const Type*, NodeID> record_definitions;
-    std::map<NamedDecl*, NodeID> named_decls;
-    std::map<int64_t, NodeID> clang_to_node_id; 
+    llvm::DenseMap<const Type*, NodeID> record_definitions;
+    llvm::DenseMap<NamedDecl*, NodeID> named_decls;
+    llvm::DenseMap<int64_t, NodeID> clang_to_node_id; 
+
+    // the first Struct.Child edge into a node gives its parent
+    llvm::DenseMap<NodeID, NodeID> struct_parents;
 
     ASTContext* ast_ctx;
 
@@ -30,12 +30,12 @@ struct HetList<A> {
 
 template<typename... As>
 struct TableAux {
-    static void output_row(HetList<As...> row, std::ofstream& stream, std::string delim);
+    static void output_row(const HetList<As...>& row, std::ofstream& stream, const std::string& delim);
 };
 
 template<typename A, typename... As>
 struct TableAux<A, As...> {
-    static void output_row(HetList<A, As...> row, std::ofstream& stream, std::string delim) {
+    static void output_row(const HetList<A, As...>& row, std::ofstream& stream, const std::string& delim) {
         stream << row.head << delim;
         TableAux<As...>::output_row(row.tail, stream, delim);
     }
@@ -43,7 +43,7 @@ struct TableAux<A, As...> {
 
 template<typename A>
 struct TableAux<A> {
-    static void output_row(HetList<A> row, std::ofstream& stream, std::string delim) {
+    static void output_row(const HetList<A>& row, std::ofstream& stream, const std::string& delim) {
         stream << row.head;
     }
 };
@@ -58,14 +58,16 @@ public:
     Table(Rows rows) : rows(rows) {}
     Table() : rows(std::vector<Row>()) {}
 
-    Table operator <<(Row r) {
-        rows.push_back(r);
+    Table& operator <<(Row r) {
+        rows.push_back(std::move(r));
         return *this;
     }
     Row operator [](int index) { return rows[index]; }
 
+    void reserve(size_t n) { rows.reserve(n); }
+
     void output_csv(std::ofstream& stream, std::string delim, std::string newline) {
-        for(auto row : rows) {
+        for(const auto& row : rows) {
             TableAux<As...>::output_row(row, stream, delim);
             stream << newline;
         }
@@ -0,0 +1,269 @@
+"""
+Merges the per-translation-unit graph shards written by the CLE plugin
+(-plugin-arg-cle shard-dir=DIR) into one program graph.
+
+    python3 merge.py -o OUT_DIR SHARD_DIR [SHARD_DIR ...]
+
+Every argument is either a shard (a directory containing nodes.csv,
+edges.csv, collated.json and decls.csv) or a directory of shards. Shards
+are processed in sorted path order, so the result does not depend on the
+order in which they were built.
+
+- Declarations with the same USR are unified. The representative is the
+  first definition, or the first declaration if none is a definition.
+  Parameters follow their function and position.
+- When several translation units define the same entity (e.g. an inline
+  function in a header), the body of every definition but the
+  representative is dropped.
+- Call and reference edges that pointed at a local declaration of a
+  function defined elsewhere now point at the definition, which connects
+  the translation units. Edges repeated across shards are kept once.
+- CLE labels are deduplicated by name; conflicting definitions are
+  reported and the first one is kept.
+- Nodes and edges are renumbered like reorder_nodes/reorder_edges: by kind,
+  then by shard, then by their ID in the shard. Merging a single shard
+  reproduces its tables exactly.
+
+The output is itself a shard, so merges can be nested.
+"""
+
+import argparse
+import csv
+import json
+import os
+import re
+import sys
+
+NODES_CSV = 'nodes.csv'
+EDGES_CSV = 'edges.csv'
+DECLS_CSV = 'decls.csv'
+COLLATED_JSON = 'collated.json'
+
+# In the order of NodeKind/EdgeKind in PGraph.h. A name shared by several
+# kinds (Stmt.Call) covers consecutive kinds, so ranking by name keeps the
+# order the plugin produced.
+NODE_KINDS = [
+    'Decl.Var', 'Decl.Function', 'Decl.Record', 'Decl.Field', 'Decl.Method',
+    'Decl.Param', 'Decl.Constructor', 'Decl.Destructor', 'Stmt.Decl',
+    'Stmt.Call', 'Stmt.Compound', 'Stmt.Ref', 'Stmt.Field', 'Stmt.This',
+    'Stmt.Return', 'Stmt.Other',
+]
+EDGE_KINDS = [
+    'Struct.Field', 'Struct.Method', 'Struct.Constructor', 'Struct.Inherit',
+    'Struct.Param', 'Struct.Child', 'Control.Entry',
+    'Control.FunctionInvocation', 'Control.MethodInvocation',
+    'Control.ConstructorInvocation', 'Control.DestructorInvocation',
+    'Data.DefUse', 'Data.ArgPass', 'Data.Return', 'Data.Object',
+    'Data.FieldAccess', 'Data.Decl',
+]
+NODE_RANK = {name: i for i, name in enumerate(NODE_KINDS)}
+EDGE_RANK = {name: i for i, name in enumerate(EDGE_KINDS)}
+
+# node table columns
+ID, KIND, NAME, ANNOTATION, PARENT_DECL, PARENT_CLASS, PARENT_FUNCTION, PARAM_IDX = range(8)
+
+
+class Shard:
+    def __init__(self, index, path):
+        self.index = index
+        self.path = path
+
+        with open(os.path.join(path, NODES_CSV), newline='') as f:
+            self.nodes = {int(row[ID]): row for row in csv.reader(f)}
+        with open(os.path.join(path, EDGES_CSV), newline='') as f:
+            self.edges = [(int(e[0]), e[1], int(e[2]), int(e[3])) for e in csv.reader(f)]
+
+        # node -> (usr, is definition), only the first node of each USR
+        self.decls = {}
+        seen = set()
+        with open(os.path.join(path, DECLS_CSV)) as f:
+            for line in f:
+                node_id, definition, usr = line.rstrip('\n').split(',', 2)
+                if usr not in seen:
+                    seen.add(usr)
+                    self.decls[int(node_id)] = (usr, definition == '1')
+
+        # param -> function, from the Struct.Param edges
+        self.param_function = {dst: src for _, kind, src, dst in self.edges
+                               if kind == 'Struct.Param'}
+
+        with open(os.path.join(path, COLLATED_JSON)) as f:
+            self.labels = parse_labels(f.read())
+
+
+def parse_labels(text):
+    """(label, raw json) pairs, keeping the JSON text as the plugin wrote it."""
+    decoder = json.JSONDecoder()
+    labels = []
+    pattern = re.compile(r'\{"cle-label": "((?:[^"\\]|\\.)*)","cle-json":')
+    pos = 0
+    while True:
+        match = pattern.search(text, pos)
+        if not match:
+            return labels
+        _, end = decoder.raw_decode(text, match.end())
+        labels.append((match.group(1), text[match.end():end]))
+        pos = end
+
+
+def find_shards(paths):
+    shards = []
+    for path in paths:
+        if os.path.exists(os.path.join(path, NODES_CSV)):
+            shards.append(path)
+            continue
+        for root, _, files in os.walk(path):
+            if NODES_CSV in files:
+                shards.append(root)
+    return sorted(set(os.path.normpath(s) for s in shards))
+
+
+def merge(shards):
+    # representative of each USR: the first definition, else the first declaration
+    representative = {}
+    for shard in shards:
+        for node_id, (usr, definition) in sorted(shard.decls.items()):
+            rep = representative.get(usr)
+            if rep is None or (definition and not rep[2]):
+                representative[usr] = (shard.index, node_id, definition)
+
+    # other definitions of a represented entity; their bodies are dropped
+    duplicates = set()
+    for shard in shards:
+        for node_id, (usr, definition) in shard.decls.items():
+            rep = representative[usr]
+            if definition and rep[:2] != (shard.index, node_id):
+                duplicates.add((shard.index, node_id))
+
+    def canonical_decl(shard, node_id):
+        if node_id in shard.decls:
+            return representative[shard.decls[node_id][0]][:2]
+        return (shard.index, node_id)
+
+    # params of each function, by position
+    params = {}
+    for shard in shards:
+        for param, function in shard.param_function.items():
+            params.setdefault((shard.index, function, shard.nodes[param][PARAM_IDX]),
+                              (shard.index, param))
+
+    canonical = {}
+    for shard in shards:
+        for node_id, row in shard.nodes.items():
+            key = (shard.index, node_id)
+            parent_function = row[PARENT_FUNCTION]
+            if node_id in shard.decls:
+                canonical[key] = canonical_decl(shard, node_id)
+            elif node_id in shard.param_function:
+                function = canonical_decl(shard, shard.param_function[node_id])
+                canonical[key] = params.get(function + (row[PARAM_IDX],), key)
+            elif parent_function and (shard.index, int(parent_function)) in duplicates:
+                continue
+            else:
+                canonical[key] = key
+
+    # a node whose function body was dropped is dropped too
+    kept = sorted((key for key, value in canonical.items() if key == value),
+                  key=lambda key: (NODE_RANK.get(shards[key[0]].nodes[key[1]][KIND], len(NODE_RANK)),
+                                   key[0], key[1]))
+    new_id = {key: i + 1 for i, key in enumerate(kept)}
+
+    def renumber(shard, node_id):
+        key = canonical.get((shard.index, node_id))
+        return new_id.get(key) if key else None
+
+    # annotations of the unified declarations, first one wins
+    annotations = {}
+    for shard in shards:
+        for node_id, row in shard.nodes.items():
+            key = canonical.get((shard.index, node_id))
+            if key and row[ANNOTATION] and key not in annotations:
+                annotations[key] = row[ANNOTATION]
+
+    nodes = []
+    for key in kept:
+        shard = shards[key[0]]
+        row = list(shard.nodes[key[1]])
+        row[ID] = str(new_id[key])
+        row[ANNOTATION] = row[ANNOTATION] or annotations.get(key, '')
+        for col in (PARENT_DECL, PARENT_CLASS, PARENT_FUNCTION):
+            if row[col]:
+                parent = renumber(shard, int(row[col]))
+                row[col] = str(parent) if parent else ''
+        nodes.append(row)
+
+    # edges repeated within one shard are kept, as the plugin wrote them
+    first_shard = {}
+    edges = []
+    for shard in shards:
+        for edge_id, kind, src, dst in shard.edges:
+            new_src, new_dst = renumber(shard, src), renumber(shard, dst)
+            if new_src is None or new_dst is None:
+                continue
+            if first_shard.setdefault((kind, new_src, new_dst), shard.index) != shard.index:
+                continue
+            edges.append((EDGE_RANK.get(kind, len(EDGE_RANK)), shard.index, edge_id,
+                          kind, new_src, new_dst))
+    edges.sort()
+    edges = [[str(i + 1), kind, str(src), str(dst)]
+             for i, (_, _, _, kind, src, dst) in enumerate(edges)]
+
+    decls = []
+    for key in kept:
+        shard = shards[key[0]]
+        if key[1] in shard.decls:
+            usr, definition = shard.decls[key[1]]
+            decls.append((new_id[key], definition, usr))
+
+    labels = []
+    label_json = {}
+    for shard in shards:
+        for label, raw in shard.labels:
+            if label not in label_json:
+                label_json[label] = raw
+                labels.append((label, raw))
+            elif json.loads(raw) != json.loads(label_json[label]):
+                print('conflicting definitions of cle label %s in %s' % (label, shard.path),
+                      file=sys.stderr)
+
+    return nodes, edges, decls, labels
+
+
+def write(out_dir, nodes, edges, decls, labels):
+    os.makedirs(out_dir, exist_ok=True)
+
+    # same layout as Table::output_csv: no trailing quoting except the name
+    with open(os.path.join(out_dir, NODES_CSV), 'w') as f:
+        for row in nodes:
+            if row[NAME]:
+                row[NAME] = '"' + row[NAME] + '"'
+            f.write(','.join(row) + '\n')
+
+    with open(os.path.join(out_dir, EDGES_CSV), 'w') as f:
+        for row in edges:
+            f.write(','.join(row) + '\n')
+
+    with open(os.path.join(out_dir, DECLS_CSV), 'w') as f:
+        for node_id, definition, usr in decls:
+            f.write('%d,%d,%s\n' % (node_id, definition, usr))
+
+    with open(os.path.join(out_dir, COLLATED_JSON), 'w') as f:
+        f.write('[' + ',\n'.join('{"cle-label": "%s","cle-json":%s}' % pair
+                                 for pair in labels) + ']')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='merge CLE graph shards')
+    parser.add_argument('-o', '--output', required=True, help='output directory')
+    parser.add_argument('shards', nargs='+', help='shards or directories of shards')
+    args = parser.parse_args()
+
+    paths = find_shards(args.shards)
+    if not paths:
+        sys.exit('no shards found')
+    shards = [Shard(i, path) for i, path in enumerate(paths)]
+    write(args.output, *merge(shards))
+
+
+if __name__ == '__main__':
+    main()
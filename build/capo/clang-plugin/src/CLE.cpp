@@ -16,6 +16,12 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Attributes.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/xxhash.h"
+
+#include "capo/Trace.h"
 
 #include "Table.h"
 #include "Graph.h"
@@ -26,10 +32,11 @@ using namespace clang;
 
 namespace cle {
 
-std::vector<std::tuple<std::string, std::string>> label_pairs;
-void output_label_pairs() {
+using LabelPairs = std::vector<std::tuple<std::string, std::string>>;
+
+void output_label_pairs(const LabelPairs& label_pairs, const std::string& path) {
     std::ofstream node_csv;
-    node_csv.open("collated.json");
+    node_csv.open(path);
     node_csv << "[";
     for(size_t i = 0; i < label_pairs.size(); i++) {
         auto [label, json] = label_pairs[i];
@@ -72,15 +79,35 @@ class Consumer : public ASTConsumer {
 private:
     CompilerInstance& ci;
     cle::pgraph::Graph pg;
+    // where the tables are written; a shard also gets decls.csv
+    std::string out_dir;
+    bool shard;
+    // the consumer is created when parsing starts
+    uint64_t parse_start = capo::trace::now();
+    // HandleTopLevelDecl runs once per declaration, those of the system
+    // headers included, so its time is summed per translation unit
+    capo::trace::Total graph_build { "graph build", capo::trace::GRAPH };
 public:
+    // the cle labels of this translation unit, filled by the pragma handler
+    LabelPairs label_pairs;
 
-    Consumer(CompilerInstance& ci) : 
-        ci(ci), pg(&ci.getASTContext()) {}
+    Consumer(CompilerInstance& ci, std::string out_dir, bool shard) : 
+        ci(ci), pg(&ci.getASTContext()), out_dir(out_dir), shard(shard) {}
+
+    std::string out_path(std::string name) {
+        llvm::SmallString<256> path(out_dir);
+        llvm::sys::path::append(path, name);
+        return path.str().str();
+    }
 
     void HandleTranslationUnit(clang::ASTContext& ctx) override {
+        // recorded first, so that it lies within the parse
+        graph_build.record();
+        capo::trace::complete("parse", capo::trace::PARSE, parse_start);
     }
 
     bool HandleTopLevelDecl(DeclGroupRef dg) override {
+        capo::trace::Total::Piece piece(graph_build);
         for(auto decl : dg) {
             pg.add_decl(decl);
         }
@@ -89,43 +116,72 @@ public:
 
 
     ~Consumer() {
-        auto ntbl = pg.node_table();
-        std::ofstream node_csv;
-        node_csv.open("nodes.csv");
-        ntbl.output_csv(node_csv, ",", "\n");
-        node_csv.close();
-
-        auto etbl = pg.edge_table();
-        std::ofstream edge_csv;
-        edge_csv.open("edges.csv");
-        etbl.output_csv(edge_csv, ",", "\n");
-        edge_csv.close();
-
-        output_label_pairs();
-    }
-};
-    
+        if(!out_dir.empty())
+            llvm::sys::fs::create_directories(out_dir);
 
-class Action : public PluginASTAction {
-protected:
-    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance& ci, llvm::StringRef) override {
-        return std::make_unique<Consumer>(ci);
-    }
+        pgraph::Graph::NodeTable ntbl;
+        {
+            capo::trace::Scope scope("node table", capo::trace::EXPORT);
+            ntbl = pg.node_table();
+        }
+        {
+            capo::trace::Scope scope("write nodes.csv", capo::trace::IO);
+            std::ofstream node_csv;
+            node_csv.open(out_path("nodes.csv"));
+            ntbl.output_csv(node_csv, ",", "\n");
+            node_csv.close();
+        }
 
-    bool ParseArgs(const CompilerInstance &ci, const std::vector<std::string> &args) override {
-        return true;
+        pgraph::Graph::EdgeTable etbl;
+        {
+            capo::trace::Scope scope("edge table", capo::trace::EXPORT);
+            etbl = pg.edge_table();
+        }
+        {
+            capo::trace::Scope scope("write edges.csv", capo::trace::IO);
+            std::ofstream edge_csv;
+            edge_csv.open(out_path("edges.csv"));
+            etbl.output_csv(edge_csv, ",", "\n");
+            edge_csv.close();
+        }
+
+        {
+            capo::trace::Scope scope("write collated.json", capo::trace::IO);
+            output_label_pairs(label_pairs, out_path("collated.json"));
+        }
+
+        if(shard) {
+            capo::trace::Scope scope("decl table", capo::trace::EXPORT);
+            auto dtbl = pg.decl_table();
+            std::ofstream decl_csv;
+            decl_csv.open(out_path("decls.csv"));
+            dtbl.output_csv(decl_csv, ",", "\n");
+            decl_csv.close();
+        }
+
+        capo::trace::finish();
     }
 };
 
 
 class Handler : public PragmaHandler {
+private:
+  LabelPairs& label_pairs;
 public:
-  Handler() : PragmaHandler("cle") { }
+  Handler(LabelPairs& label_pairs) : PragmaHandler("cle"), label_pairs(label_pairs) { }
   void HandlePragma(Preprocessor &pp, PragmaIntroducer intro, Token &tok) override {
+    capo::trace::Scope scope("pragma", capo::trace::PREPROCESS);
     // Handle the pragma
     pp.Lex(tok);
-    if(pp.getSpelling(tok) != "def") {
-        pp.Diag(tok, diag::err_expected) << "unknown cle directive";
+    std::string directive = pp.getSpelling(tok);
+    if(directive != "def") {
+        // begin/end delimit the code of a level for the divider; the graph
+        // takes its labels from cle_annotate
+        if(directive != "begin" && directive != "end")
+            pp.Diag(tok, diag::err_expected) << "unknown cle directive";
+        while(tok.isNot(tok::eod) && tok.isNot(tok::eof))
+            pp.Lex(tok);
+        return;
     }
     pp.Lex(tok);
     std::string label = pp.getSpelling(tok);
@@ -134,7 +190,7 @@ public:
     size_t count = 0;
     std::string tok_str = pp.getSpelling(tok);
     bool init = true;
-    while(init || count > 0) {
+    while((init || count > 0) && tok.isNot(tok::eod) && tok.isNot(tok::eof)) {
         if(tok_str == "{")
             count++;
         if(tok_str == "}")
@@ -151,9 +207,53 @@ public:
 };
 
 
+// Without arguments the tables are written to the current directory.
+// With -plugin-arg-cle shard-dir=DIR each translation unit writes a shard,
+// named after its main file, under DIR; shards of a program are combined
+// with merge.py. With -plugin-arg-cle trace=FILE the phase timings are
+// written to FILE as a Chrome trace.
+class Action : public PluginASTAction {
+private:
+    std::string shard_dir;
+protected:
+    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance& ci, llvm::StringRef file) override {
+        std::string out_dir;
+        if(!shard_dir.empty()) {
+            llvm::SmallString<256> abs_file(file);
+            llvm::sys::fs::make_absolute(abs_file);
+            llvm::SmallString<256> path(shard_dir);
+            llvm::sys::path::append(path, llvm::sys::path::filename(file) + "." + 
+                llvm::utohexstr(llvm::xxHash64(abs_file), /*LowerCase=*/true));
+            out_dir = path.str().str();
+        }
+
+        auto consumer = std::make_unique<Consumer>(ci, out_dir, !shard_dir.empty());
+        // owned by the preprocessor, which only invokes it while the consumer is alive
+        ci.getPreprocessor().AddPragmaHandler(new Handler(consumer->label_pairs));
+        return consumer;
+    }
+
+    bool ParseArgs(const CompilerInstance &ci, const std::vector<std::string> &args) override {
+        for(auto &arg : args) {
+            llvm::StringRef ref(arg);
+            if(ref.consume_front("shard-dir=")) {
+                shard_dir = ref.str();
+            } else if(ref.consume_front("trace=")) {
+                auto &inputs = ci.getFrontendOpts().Inputs;
+                capo::trace::enable(ref.str(), inputs.empty() ? "cle" : "cle " + inputs[0].getFile().str());
+            } else {
+                unsigned id = ci.getDiagnostics().getCustomDiagID(
+                    DiagnosticsEngine::Error, "unknown cle plugin argument '%0'");
+                ci.getDiagnostics().Report(id) << arg;
+                return false;
+            }
+        }
+        return true;
+    }
 };
-static PragmaHandlerRegistry::Add<cle::Handler> Z("cle", "cle pragma handler");
 
+
+};
 static ParsedAttrInfoRegistry::Add<cle::AttrInfo> Y("cle", "cle annotator");
 
 static FrontendPluginRegistry::Add<cle::Action> X("cle", "cle annotation codegen");
\ No newline at end of file
@@ -93,14 +93,26 @@ std::string pgraph::edge_kind_name(EdgeKind kind) {
 
 
 NodeID pgraph::Graph::add_node(Node&& node) {
-    nodes.insert(std::pair<NodeID, Node>(cur_node_id, node));
-    auto n = nodes.at(cur_node_id);
+    NodeID id = cle::Graph<Node, Edge>::add_node(std::move(node));
+    auto &n = nodes.back();
     auto decl = n.named_decl();
-    clang_to_node_id[node.clang_node_id(ast_ctx)] = cur_node_id; 
+    clang_to_node_id[n.clang_node_id(ast_ctx)] = id; 
     if(decl)
-        named_decls[*decl] = cur_node_id; 
-    cur_node_id++;
-    return cur_node_id - 1;
+        named_decls[*decl] = id; 
+    numbering.reset();
+    return id;
+}
+
+EdgeID pgraph::Graph::add_edge(Edge&& edge) {
+    if(edge.kind == EdgeKind::STRUCT_CHILD)
+        struct_parents.try_emplace(edge.dst, edge.src);
+    numbering.reset();
+    return cle::Graph<Node, Edge>::add_edge(std::move(edge));
+}
+
+void pgraph::Graph::replace_node(NodeID id, Node node) {
+    cle::Graph<Node, Edge>::replace_node(id, node);
+    numbering.reset();
 }
 
 NodeID pgraph::Graph::add_method_decl(CXXMethodDecl* decl, NodeCtx ctx) {
@@ -122,7 +134,6 @@ NodeID pgraph::Graph::add_function_like(ClangDecl* decl, NodeCtx ctx) {
         }
         if(named_decls.find(redecl) != named_decls.end()) {
             id = named_decls[redecl];
-            auto node = get_node(id);
             if(decl_with_body != nullptr) {
                 replace_node(id, Node(CLENode(static_cast<ClangDecl*>(decl_with_body)), ctx.set_parent_function(decl_with_body)));
                 auto cid = add_stmt(decl_with_body->getBody(), ctx.set_parent_function(decl_with_body));
@@ -232,7 +243,7 @@ NodeID pgraph::Graph::add_call_stmt(CallExpr* stmt, NodeCtx ctx) {
     size_t idx = 0;
     for(auto arg : stmt->arguments()) {
         auto aid = add_stmt(arg, ctx);
-        nodes.find(aid)->second.param_idx = idx++;
+        nodes[aid].param_idx = idx++;
         add_edge(Edge(id, aid, DATA_ARGPASS));
     }
 
@@ -251,8 +262,7 @@ NodeID pgraph::Graph::add_member_call_stmt(CXXMemberCallExpr* stmt, NodeCtx ctx)
         } else {
             fid = add_method_decl(decl, ctx);
         }
-        auto node = get_node(fid);
-        if(node.kind == DECL_DESTRUCTOR) {
+        if(get_node(fid).kind == DECL_DESTRUCTOR) {
             add_edge(Edge(id, fid, CONTROL_DESTRUCTOR_INVOCATION));
         } else {
             add_edge(Edge(id, fid, CONTROL_METHOD_INVOCATION));
@@ -262,7 +272,7 @@ NodeID pgraph::Graph::add_member_call_stmt(CXXMemberCallExpr* stmt, NodeCtx ctx)
     size_t idx = 0;
     for(auto arg : stmt->arguments()) {
         auto aid = add_stmt(arg, ctx);
-        nodes.find(aid)->second.param_idx = idx++;
+        nodes[aid].param_idx = idx++;
         add_edge(Edge(id, aid, DATA_ARGPASS));
     }
 
@@ -294,7 +304,7 @@ NodeID pgraph::Graph::add_constructor_call_stmt(CXXConstructExpr* stmt, NodeCtx
     size_t idx = 0; 
     for(auto arg : stmt->arguments()) {
         auto aid = add_stmt(arg, ctx);
-        nodes.find(aid)->second.param_idx = idx++;
+        nodes[aid].param_idx = idx++;
         add_edge(Edge(id, aid, DATA_ARGPASS));
     }
 
@@ -360,12 +370,9 @@ void pgraph::Graph::add_implicit_destructors(Decl* decl, Stmt* body, NodeCtx ctx
                 if(clang_to_node_id.find(clang_id) != clang_to_node_id.end()) {
                     auto id = clang_to_node_id[clang_id];
                     std::optional<NodeID> parent_id = std::nullopt; 
-                    for(auto [eid, edge] : edges) {
-                        if(edge.kind == EdgeKind::STRUCT_CHILD && edge.dst == id) {
-                            parent_id = edge.src;
-                            break;
-                        }
-                    }
+                    auto parent = struct_parents.find(id);
+                    if(parent != struct_parents.end())
+                        parent_id = parent->second;
                     if(parent_id) {
                         auto did = add_node(Node(StmtImplicitDestructor(*dtor), ctx));
                         add_edge(Edge(*parent_id, did, EdgeKind::STRUCT_CHILD));
@@ -389,7 +396,7 @@ NodeID pgraph::Graph::add_record_decl(CXXRecordDecl* decl, NodeCtx ctx) {
     for(auto redecl : decl->redecls()) {
         if(named_decls.find(redecl) != named_decls.end()) {
             id = named_decls[redecl];
-            auto node = get_node(id);
+            auto &node = get_node(id);
             if(!node.decl_record.decl->hasDefinition() && decl->hasDefinition()) {
                 replace_node(id, Node(DeclRecord(decl), ctx));
             }
@@ -573,36 +580,52 @@ int64_t pgraph::Node::clang_node_id(ASTContext* ctx) {
     }
 }
 
-std::map<NodeID, NodeID> pgraph::Graph::reorder_nodes() {
-    std::map<NodeID, NodeID> map;
-    std::map<NodeKind, std::set<NodeID>> buckets;
-    for(auto [id, node] : nodes) {
-        buckets[node.kind].insert(id);
-    }
-    NodeID idx = 1;
-    for(auto [kind, bucket] : buckets) {
-        for(auto id : bucket) {
-            map[id] = idx; 
-            idx++;
-        }
-    }
-    return map;
+// Stable counting sort by kind: the items of the first kind in ID order,
+// then those of the next kind, and so on. Returns the 1-based position of
+// each item.
+template<typename T>
+static std::vector<size_t> number_by_kind(const std::vector<T>& items) {
+    size_t num_kinds = 0;
+    for(auto &item : items)
+        num_kinds = std::max(num_kinds, (size_t) item.kind + 1);
+
+    std::vector<size_t> next(num_kinds + 1, 0);
+    for(auto &item : items)
+        next[item.kind + 1]++;
+    next[0] = 1;
+    for(size_t k = 1; k <= num_kinds; k++)
+        next[k] += next[k - 1];
+
+    std::vector<size_t> ids(items.size());
+    for(size_t i = 0; i < items.size(); i++)
+        ids[i] = next[items[i].kind]++;
+    return ids;
 }
 
-std::map<EdgeID, EdgeID> pgraph::Graph::reorder_edges() {
-    std::map<EdgeID, EdgeID> map;
-    std::map<EdgeKind, std::set<NodeID>> buckets;
-    for(auto [id, edge] : edges) {
-        buckets[edge.kind].insert(id);
-    }
-    EdgeID idx = 1;
-    for(auto [kind, bucket] : buckets) {
-        for(auto id : bucket) {
-            map[id] = idx; 
-            idx++;
-        }
-    }
-    return map;
+std::vector<NodeID> pgraph::Graph::reorder_nodes() {
+    return number_by_kind(nodes);
+}
+
+std::vector<EdgeID> pgraph::Graph::reorder_edges() {
+    return number_by_kind(edges);
+}
+
+const pgraph::Graph::Numbering& pgraph::Graph::renumber() {
+    if(numbering)
+        return *numbering;
+
+    Numbering n;
+    n.node_ids = reorder_nodes();
+    n.edge_ids = reorder_edges();
+    n.node_order.resize(nodes.size());
+    for(NodeID id = 0; id < nodes.size(); id++)
+        n.node_order[n.node_ids[id] - 1] = id;
+    n.edge_order.resize(edges.size());
+    for(EdgeID id = 0; id < edges.size(); id++)
+        n.edge_order[n.edge_ids[id] - 1] = id;
+
+    numbering = std::move(n);
+    return *numbering;
 }
 
 
@@ -618,15 +641,12 @@ std::optional<NodeID> pgraph::Graph::find_node(NamedDecl* decl) {
 
 pgraph::Graph::NodeTable pgraph::Graph::node_table() {
     pgraph::Graph::NodeTable tbl;
-    std::map<NodeID, NodeID> node_id_map = reorder_nodes(); 
-    std::vector<std::tuple<NodeID, NodeID>> reordered_nodes;
-    for(auto [id, node] : nodes) {
-        if(node_id_map[id] != 0)
-            reordered_nodes.push_back(std::tuple<NodeID, NodeID>(node_id_map[id], id));
-    }
-    std::sort(reordered_nodes.begin(), reordered_nodes.end());
-    for(auto [r_id, id] : reordered_nodes) {
-        auto node = nodes.find(id)->second;
+    const Numbering& numbering = renumber();
+    const std::vector<NodeID>& node_id_map = numbering.node_ids;
+    tbl.reserve(nodes.size());
+    for(NodeID id : numbering.node_order) {
+        NodeID r_id = node_id_map[id];
+        auto &node = nodes[id];
         std::string name = node.qualified_name().value_or("");
         if(name.size() > 0)
             name = "\"" + name + "\"";
@@ -679,21 +699,46 @@ pgraph::Graph::NodeTable pgraph::Graph::node_table() {
 
 pgraph::Graph::EdgeTable pgraph::Graph::edge_table() {
     pgraph::Graph::EdgeTable tbl;
-    std::map<NodeID, NodeID> node_id_map = reorder_nodes(); 
-    std::map<EdgeID, EdgeID> edge_id_map = reorder_edges(); 
-
-    std::vector<std::tuple<NodeID, NodeID>> reordered_edges;
-    for(auto [id, edge] : edges) {
-        if(edge_id_map[id] != 0)
-            reordered_edges.push_back(std::tuple<NodeID, NodeID>(edge_id_map[id], id));
-    }
-    std::sort(reordered_edges.begin(), reordered_edges.end());
-    
-    for(auto [r_id, id] : reordered_edges) {
-        auto edge = edges.find(id)->second;
+    const Numbering& numbering = renumber();
+    const std::vector<NodeID>& node_id_map = numbering.node_ids;
+    tbl.reserve(edges.size());
+    for(EdgeID id : numbering.edge_order) {
+        auto &edge = edges[id];
         std::string ek_name = edge_kind_name(edge.kind);
-        HetList<EdgeID, std::string, NodeID, NodeID> row{r_id, ek_name, node_id_map[edge.src], node_id_map[edge.dst]};
+        HetList<EdgeID, std::string, NodeID, NodeID> row{numbering.edge_ids[id], ek_name, node_id_map[edge.src], node_id_map[edge.dst]};
+        tbl << row;
+    }
+    return tbl;
+}
+
+
+// The USR of every declaration node, used to unify declarations across
+// translation units when shards are merged. Parameters are left out: they
+// are unified through their function and position instead.
+pgraph::Graph::DeclTable pgraph::Graph::decl_table() {
+    pgraph::Graph::DeclTable tbl;
+    const Numbering& numbering = renumber();
+    for(NodeID id : numbering.node_order) {
+        auto &node = nodes[id];
+        auto decl = node.named_decl();
+        if(!decl || node.kind == DECL_PARAM)
+            continue;
+
+        llvm::SmallString<128> usr;
+        if(clang::index::generateUSRForDecl(*decl, usr))
+            continue;
+
+        unsigned int definition = 1;
+        if(auto fdecl = dyn_cast<FunctionDecl>(*decl))
+            definition = fdecl->doesThisDeclarationHaveABody();
+        else if(auto tdecl = dyn_cast<TagDecl>(*decl))
+            definition = tdecl->isThisDeclarationADefinition();
+        else if(auto vdecl = dyn_cast<VarDecl>(*decl))
+            definition = vdecl->isThisDeclarationADefinition() == VarDecl::Definition;
+
+        // the USR goes last, it may contain the delimiter
+        HetList<NodeID, unsigned int, std::string> row{numbering.node_ids[id], definition, usr.str().str()};
         tbl << row;
     }
     return tbl;
-}
\ No newline at end of file
+}
@@ -0,0 +1,124 @@
+"""
+Synthetic benchmark for the divider's annotation matching.
+
+Generates one source file with N annotated functions and global variables,
+spread over K levels and enclosed in #pragma cle blocks, together with the
+matching topology.json, then times the divider on it. A share of them
+(--qualified percent) is declared in a namespace and annotated as ns::f or,
+every other one, as ::ns::f. Pass --baseline to
+time a second divider binary (e.g. one built from an older commit) on the
+same input.
+
+    python3 bench/annotations.py --divider build/bin/divider \
+        --baseline /tmp/divider-old --annotations 10000
+"""
+
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import tempfile
+import time
+
+
+def generate(root, annotations, levels, qualified):
+    src_dir = os.path.join(root, 'src')
+    os.makedirs(src_dir)
+
+    level_names = ['level%d' % i for i in range(levels)]
+    functions = []
+    global_scoped_vars = []
+
+    lines = []
+    for i in range(annotations):
+        level = level_names[i % levels]
+        label = level.upper()
+        # spread evenly, so that both kinds and all levels get qualified names
+        namespace = 'ns%d' % (i % 10) if (i * qualified) // 100 != ((i + 1) * qualified) // 100 else None
+        if namespace:
+            lines.append('namespace %s {' % namespace)
+        lines.append('#pragma cle begin %s' % label)
+        if i % 2 == 0:
+            name = 'func_%d' % i
+            lines.append('int %s(int x) { return x + %d; }' % (name, i))
+            names = functions
+        else:
+            name = 'var_%d' % i
+            lines.append('int %s = %d;' % (name, i))
+            names = global_scoped_vars
+        lines.append('#pragma cle end %s' % label)
+        if namespace:
+            lines.append('}')
+            name = ('::' if (i // 2) % 2 else '') + namespace + '::' + name
+        names.append(name)
+        lines.append('')
+
+    with open(os.path.join(src_dir, 'annotated.cpp'), 'w') as f:
+        f.write('\n'.join(lines))
+
+    def annotation(i, name):
+        level = level_names[i % levels]
+        return {'name': name, 'level': level, 'enclave': level + '_E', 'line': 0}
+
+    topology = {
+        'source_path': src_dir,
+        'enclaves': [],
+        'levels': level_names,
+        'functions': [annotation(i * 2, name) for i, name in enumerate(functions)],
+        'global_scoped_vars': [annotation(i * 2 + 1, name) for i, name in enumerate(global_scoped_vars)],
+    }
+    topology_json = os.path.join(root, 'topology.json')
+    with open(topology_json, 'w') as f:
+        json.dump(topology, f, indent=2)
+
+    return topology_json
+
+
+def run(divider, topology_json, output_dir, runs):
+    args = [divider, '--output-dir', output_dir]
+    help_text = subprocess.run([divider, '--help'], capture_output=True, text=True).stdout
+    if '-incremental' in help_text:
+        args.append('-incremental=false')
+    args += [topology_json, '--']
+
+    times = []
+    for _ in range(runs):
+        start = time.perf_counter()
+        subprocess.run(args, check=True, stdout=subprocess.DEVNULL)
+        times.append(time.perf_counter() - start)
+    return statistics.median(times)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='divider annotation matching benchmark')
+    parser.add_argument('--divider', default='build/bin/divider')
+    parser.add_argument('--baseline', help='divider binary to compare against')
+    parser.add_argument('--annotations', type=int, default=10000)
+    parser.add_argument('--levels', type=int, default=2)
+    parser.add_argument('--qualified', type=int, default=20, help='percent of qualified annotations')
+    parser.add_argument('--runs', type=int, default=3)
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as root:
+        topology_json = generate(root, args.annotations, args.levels, args.qualified)
+
+        current = run(os.path.abspath(args.divider), topology_json,
+                      os.path.join(root, 'current'), args.runs)
+        print('%d annotations (%d%% qualified), %d levels' % (args.annotations, args.qualified, args.levels))
+        print('divider:  %.3fs' % current)
+
+        if args.baseline:
+            baseline = run(os.path.abspath(args.baseline), topology_json,
+                           os.path.join(root, 'baseline'), args.runs)
+            print('baseline: %.3fs' % baseline)
+            print('speedup:  %.2fx' % (baseline / current))
+
+            subprocess.run(['diff', '-r', os.path.join(root, 'baseline'),
+                            os.path.join(root, 'current')], check=True,
+                           stdout=subprocess.DEVNULL)
+            print('outputs identical')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,68 @@
+"""
+Checks that the divider's output does not depend on how it is run.
+
+Runs a baseline divider (e.g. one built from an older commit) and the
+current divider on the same topology, the current one with -j 1 and -j N,
+and compares the <output-dir>/<level> trees byte for byte. Arguments after
+the topology are passed to both dividers, e.g. the --extra-arg options of
+the websrv example in the README. Run it from where the topology's
+source_path is relative to, as the README runs the divider.
+
+    cd build
+    python3 ../bench/compare.py --baseline /tmp/divider-old --divider bin/divider \\
+        ../test/topology.json
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+
+def supports(divider, option):
+    help_text = subprocess.run([divider, '--help'], capture_output=True, text=True).stdout
+    return option in help_text
+
+
+def divide(divider, topology, extra, output_dir, jobs=None):
+    args = [divider, '--output-dir', output_dir]
+    if supports(divider, '-incremental'):
+        args.append('-incremental=false')
+    if jobs is not None:
+        args += ['-j', str(jobs)]
+    args += extra + [topology, '--']
+    subprocess.run(args, check=True, stdout=subprocess.DEVNULL)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='divider output comparison')
+    parser.add_argument('--baseline', required=True, help='divider binary to compare against')
+    parser.add_argument('--divider', default='bin/divider')
+    parser.add_argument('--jobs', type=int, default=os.cpu_count(), help='N of the -j N run')
+    parser.add_argument('topology')
+    parser.add_argument('extra', nargs=argparse.REMAINDER, help='options for both dividers')
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as root:
+        baseline = os.path.join(root, 'baseline')
+        divide(os.path.abspath(args.baseline), args.topology, args.extra, baseline)
+
+        failed = False
+        for jobs in (1, args.jobs):
+            current = os.path.join(root, 'j%d' % jobs)
+            divide(os.path.abspath(args.divider), args.topology, args.extra, current, jobs)
+            result = subprocess.run(['diff', '-r', '--exclude=.divider-cache*', baseline, current],
+                                    capture_output=True, text=True)
+            if result.returncode == 0:
+                print('-j %d: identical to the baseline' % jobs)
+            else:
+                print('-j %d: differs from the baseline' % jobs)
+                print(result.stdout, end='')
+                failed = True
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
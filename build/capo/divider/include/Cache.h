@@ -0,0 +1,70 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace std;
+
+// What a divided file was produced from: a key over the file contents, the
+// topology and the compile command, plus the hash of every header the file
+// included at the time.
+class CacheEntry
+{
+public:
+    string key;
+    map<string, string> dependencies;
+    double seconds = 0;
+};
+
+// On-disk manifest of the files divided by the previous run. A file whose
+// key and included headers are unchanged, and whose outputs still exist,
+// is not divided again. Shared by all jobs.
+class Cache
+{
+protected:
+    string manifest;
+
+    // entries of the previous run, and of the current run
+    map<string, CacheEntry> previous;
+    map<string, CacheEntry> current;
+
+    // file -> content hash, each file is read at most once per run
+    map<string, string> fileHashes;
+
+    unsigned hits = 0;
+    unsigned misses = 0;
+    double savedSeconds = 0;
+
+    std::mutex lock;
+
+public:
+    explicit Cache(string manifest)
+        : manifest(manifest) {
+    }
+
+    void load();
+    void save();
+
+    static string hash(llvm::StringRef data);
+    string hashFile(const string &path);
+
+    bool lookup(const string &file, const string &key, const vector<string> &outputs);
+    void update(const string &file, const string &key, const set<string> &dependencies,
+                double seconds);
+
+    void report(llvm::raw_ostream &os);
+};
+
+// Write or copy a file only if its content differs, so that unchanged
+// outputs keep their modification time.
+bool writeIfChanged(const string &file, llvm::StringRef content);
+bool copyIfChanged(const string &from, const string &to);
+
+#endif // CACHE_H
@@ -0,0 +1,108 @@
+#ifndef FILE_CONTEXT_H
+#define FILE_CONTEXT_H
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+using namespace std;
+
+class ClePair
+{
+private:
+    SourceRange begin;
+    SourceRange end;
+    string pragma;
+
+public:
+    ClePair(SourceRange begin, SourceRange end, string pragma) {
+        this->begin = begin;
+        this->end = end;
+        this->pragma = pragma;
+    }
+
+    SourceRange &getBegin() {
+        return begin;
+    }
+
+    SourceRange &getEnd() {
+        return end;
+    }
+
+    void setEnd(SourceRange end) {
+        this->end = end;
+    }
+
+    string &getPragma() {
+        return pragma;
+    }
+};
+
+// The mutable state of dividing one source file: the file being processed,
+// its #pragma cle ranges and the messages produced for it. Each job owns one,
+// so that files can be divided concurrently against a shared, read-only Topology.
+class FileContext
+{
+protected:
+    // path relative to the source path, also used under each level's output dir
+    string fileInProcess;
+    vector<ClePair> cleRange;
+
+    // Lines split into segments by the cleRange endpoints. Each entry is the
+    // first line of a segment and the lowest index of a pair strictly
+    // enclosing it, or -1. Built on the first lookup, once all pragmas
+    // of the file have been seen.
+    vector<pair<int, int>> cleIndex;
+    bool cleIndexed = false;
+
+    void buildCleIndex(const SourceManager &sm);
+
+    // headers included by the file, transitively
+    set<string> dependencies;
+
+    string messages;
+    llvm::raw_string_ostream logStream;
+
+public:
+    explicit FileContext(string fileInProcess)
+        : fileInProcess(fileInProcess), logStream(messages) {
+    }
+
+    void addCleRangeOpen(SourceRange range, string pragma);
+    void addCleRangeClose(SourceRange range, string pragma);
+
+    // index of the first pair whose begin and end lines enclose the line, or -1
+    int findEnclosingCle(const SourceManager &sm, int line);
+
+    string &getFileInProcess() {
+        return this->fileInProcess;
+    }
+
+    vector<ClePair> &getCleRange() {
+        return this->cleRange;
+    }
+
+    void addDependency(string path) {
+        dependencies.insert(path);
+    }
+
+    set<string> &getDependencies() {
+        return this->dependencies;
+    }
+
+    // buffered so that the output of concurrent jobs does not interleave
+    llvm::raw_ostream &log() {
+        return this->logStream;
+    }
+
+    string &getMessages() {
+        return this->logStream.str();
+    }
+};
+
+#endif // FILE_CONTEXT_H
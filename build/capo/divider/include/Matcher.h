@@ -1,6 +1,7 @@
 #ifndef MATCHER_H
 #define MATCHER_H
 
+#include <memory>
 #include <vector>
 
 #include "clang/AST/ASTConsumer.h"
@@ -12,79 +13,62 @@
 #include "clang/Rewrite/Frontend/FixItRewriter.h"
 // #include "clang/Lex/Preprocessor.h"
 
+#include "capo/Trace.h"
+
+#include "FileContext.h"
 #include "Topology.h"
 
 using namespace clang;
 using namespace ast_matchers;
 
-class ClePair
+// The annotated function and global variable of a match, if any. They do
+// not depend on the level, so LevelDispatcher decides them once per match.
+struct AnnotatedDecls
 {
-private:
-    SourceRange begin;
-    SourceRange end;
-    string pragma;
-
-public:
-    ClePair(SourceRange begin, SourceRange end, string pragma) {
-        this->begin = begin;
-        this->end = end;
-        this->pragma = pragma;
-    }
-
-    SourceRange &getBegin() {
-        return begin;
-    }
-
-    SourceRange &getEnd() {
-        return end;
-    }
-
-    void setEnd(SourceRange end) {
-        this->end = end;
-    }
-
-    string &getPragma() {
-        return pragma;
-    }
+    const FunctionDecl *func = nullptr;
+    const VarDecl *var = nullptr;
 };
 
+// Whether decl is in the file in process; file is its path from the output
+// directory, as returned by FileContext::getFileInProcess()
+bool isInFile(const clang::SourceManager &sm, const Decl *decl, const string &file);
+
+// Rewrites the file in process for one level.
 class Matcher
-    : public clang::ast_matchers::MatchFinder::MatchCallback 
 {
 public:
     explicit Matcher(const clang::CompilerInstance &compiler,
-                                   clang::Rewriter &rewriter, Topology topology)
+                     const Topology &topology, FileContext &context, string level)
         :ctx(&compiler.getASTContext()), 
          langOpts(compiler.getLangOpts()),
-         rewriter(rewriter), 
          topology(topology),
+         context(context),
+         level(level),
+         levelId(topology.getLevelId(level)),
          sm(compiler.getSourceManager()) {
+        // each level rewrites its own copy of the main file
+        rewriter.setSourceMgr(compiler.getSourceManager(), compiler.getLangOpts());
         // compiler.getPreprocessor().SetSuppressIncludeNotFoundError(true);
     }
     
-    void onEndOfTranslationUnit() override;
-    void run(const clang::ast_matchers::MatchFinder::MatchResult &) override;
-    bool isInFile(const clang::SourceManager &sm, const Decl *decl);
-
-    static void addCleRangeOpen(SourceRange range, string pargma);
-    static void addCleRangeClose(SourceRange range, string pargma);
-
-    static vector<ClePair> &getCleRange() {
-        return cleRange;
-    }
-
-    static void clearCleRange() {
-        cleRange.clear();
+    void onEndOfTranslationUnit();
+    void run(const clang::ast_matchers::MatchFinder::MatchResult &, const AnnotatedDecls &annotated);
+    bool isInFile(const clang::SourceManager &sm, const Decl *decl) {
+        return ::isInFile(sm, decl, context.getFileInProcess());
     }
 
 private:
     clang::ASTContext *ctx;
     clang::LangOptions langOpts;
     clang::Rewriter rewriter;
-    Topology topology;
+    const Topology &topology;
+    FileContext &context;
+    string level;
+    int levelId;
     vector<SourceRange> parentRanges;
     SourceManager &sm;
-    static vector<ClePair> cleRange;
+    // the edits made for the matched declarations, recorded per file
+    capo::trace::Total rewriting { "rewriting", capo::trace::REWRITE };
 
     bool matchFunctionDecl(const clang::SourceManager &sm, const FunctionDecl *func);
     bool matchFunctionCall(const clang::SourceManager &sm, const CallExpr *expr);
@@ -103,13 +87,45 @@ private:
     SourceLocation findSemiAfterLocation(SourceLocation loc, ASTContext &Ctx, bool IsDecl);
 };
 
+// Forwards every match to one Matcher per level, so that a single AST
+// traversal produces the rewritten output of all levels.
+class LevelDispatcher
+    : public clang::ast_matchers::MatchFinder::MatchCallback 
+{
+public:
+    LevelDispatcher(const Topology &topology, FileContext &context)
+        : topology(topology), context(context) {
+    }
+
+    void addMatcher(std::unique_ptr<Matcher> matcher) {
+        matchers.push_back(std::move(matcher));
+    }
+
+    void onEndOfTranslationUnit() override {
+        for (auto &matcher : matchers)
+            matcher->onEndOfTranslationUnit();
+    }
+
+    void run(const clang::ast_matchers::MatchFinder::MatchResult &result) override;
+
+private:
+    const Topology &topology;
+    FileContext &context;
+    vector<std::unique_ptr<Matcher>> matchers;
+
+    bool isAnnotated(const NamedDecl *decl, bool function);
+};
+
 class MatcherASTConsumer : public clang::ASTConsumer 
 {
 public:
-    explicit MatcherASTConsumer(clang::CompilerInstance &compiler, Topology &topology,
-                                       bool mainFileOnly, clang::Rewriter &rewriter);
+    explicit MatcherASTConsumer(clang::CompilerInstance &compiler, const Topology &topology,
+                                FileContext &context, bool mainFileOnly);
 
     void HandleTranslationUnit(clang::ASTContext &ctx) {
+        // the consumer is created when parsing starts
+        capo::trace::complete("parse", capo::trace::PARSE, parseStart);
+        capo::trace::Scope scope("matching", capo::trace::MATCH);
         finder.matchAST(ctx);
     }
 
@@ -119,7 +135,8 @@ private:
     bool mainTUOnly = true;
 
     clang::ast_matchers::MatchFinder finder;
-    Matcher matcherHandler;
+    LevelDispatcher matcherHandler;
+    uint64_t parseStart = capo::trace::now();
 };
 
 #endif
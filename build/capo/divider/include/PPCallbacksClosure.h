@@ -7,6 +7,8 @@
 #include "clang/Lex/Preprocessor.h"
 #include "llvm/Support/GlobPattern.h"
 
+#include "FileContext.h"
+
 namespace clang {
 namespace pp_divider {
 
@@ -15,11 +17,18 @@ using FilterType = std::vector<std::pair<llvm::GlobPattern, bool>>;
 class PPCallbacksClosure : public PPCallbacks 
 {
 public:
-    PPCallbacksClosure(const FilterType &filters, Preprocessor &preprocessor);
+    PPCallbacksClosure(const FilterType &filters, Preprocessor &preprocessor,
+                       FileContext &context);
     ~PPCallbacksClosure() override;
 
     // callback
     void PragmaDirective(SourceLocation loc, PragmaIntroducerKind introducer) override;
+    void InclusionDirective(SourceLocation hashLoc, const Token &includeTok,
+                            StringRef fileName, bool isAngled,
+                            CharSourceRange filenameRange, const FileEntry *file,
+                            StringRef searchPath, StringRef relativePath,
+                            const Module *imported,
+                            SrcMgr::CharacteristicKind fileType) override;
 
     llvm::StringRef getSourceString(CharSourceRange range);
 
@@ -27,6 +36,9 @@ public:
     const FilterType &filters;
 
     Preprocessor &preprocessor;
+
+    // receives the #pragma cle begin/end pairs and the includes of the file
+    FileContext &context;
 };
 
 } // namespace pp_divider
@@ -10,6 +10,8 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "nlohmann/json.hpp"
 
@@ -19,6 +21,15 @@
 using json = nlohmann::json;
 using namespace std;
 
+// A scope enclosing a declaration, as named by hasName(): a namespace,
+// "(anonymous namespace)", or a class. Inline namespaces may be left out
+// of a qualified name.
+struct NameScope
+{
+    string name;
+    bool isInline = false;
+};
+
 class Topology
 {
 protected:
@@ -31,69 +42,113 @@ protected:
     // levels -> (name -> annotation)
     map<string, map<string, Annotation>> allAnnotations;
 
+    // Built once after parsing, so that the matcher can decide for any
+    // (level, name) pair with hash lookups: names and levels are interned
+    // to ids and each decision is a key (levelId << 32 | nameId).
+    unordered_map<string, uint32_t> levelIds;
+    unordered_map<string, uint32_t> nameIds;
+    unordered_set<uint64_t> namesInLevel;
+    unordered_set<uint64_t> classesInLevel;
+
+    // annotated names without a qualifier; qualified ones are kept apart
+    // since they have to be compared against the qualified decl name, and
+    // are indexed by their last component, so that a decl is only compared
+    // against the patterns ending in its own name
+    unordered_set<string> functionNames;
+    unordered_set<string> globalScopedVarNames;
+    unordered_map<string, vector<string>> qualifiedFunctionNames;
+    unordered_map<string, vector<string>> qualifiedGlobalScopedVarNames;
+
+    // the parts of the JSON that the divided output of a source file, and of
+    // a copied file, depend on; used to key the divider cache
+    string rewriteSlice;
+    string levelsSlice;
+
     // not in JSON
     string outputDir;
-    string fileInProcess;
-    string levelInProgress;
 
 public:
     Topology() {
     }
 
-    string getOutputFile() {
-        return outputDir + "/" + levelInProgress + "/" + fileInProcess;
+    // Once parsed, a topology is only read, and is shared by all divider jobs.
+    string getOutputFile(const string &level, const string &file) const {
+        return outputDir + "/" + level + "/" + file;
+    }
+
+    bool isNameInLevel(const string &name, const string &level) const;
+    bool isInEnclave(const string &name, const string &level) const;
+
+    // -1 if the level is unknown
+    int getLevelId(const string &level) const;
+    bool isNameInLevel(const string &name, int levelId) const;
+    bool isInEnclave(const string &name, int levelId) const;
+
+    bool isFunction(const string &name) const {
+        return functionNames.count(name) > 0;
+    }
+
+    bool isGlobalScopedVar(const string &name) const {
+        return globalScopedVarNames.count(name) > 0;
+    }
+
+    // the qualified annotated names ending in name; null if there are none
+    const vector<string> *getQualifiedFunctionNames(const string &name) const {
+        auto it = qualifiedFunctionNames.find(name);
+        return it == qualifiedFunctionNames.end() ? nullptr : &it->second;
     }
 
-    bool isNameInLevel(string &name, string &level);
-    bool isInEnclave(string &name, string &level);
+    const vector<string> *getQualifiedGlobalScopedVarNames(const string &name) const {
+        auto it = qualifiedGlobalScopedVarNames.find(name);
+        return it == qualifiedGlobalScopedVarNames.end() ? nullptr : &it->second;
+    }
+
+    // Whether hasName(pattern) matches a declaration called name in scopes,
+    // outermost first. A pattern starting with "::" is matched against the
+    // fully qualified name, any other one against a suffix of it.
+    static bool matchesName(const string &pattern, const vector<NameScope> &scopes,
+                            const string &name);
 
     void parse(string &topology);
     void parseAnnotations(nlohmann::basic_json<> values, vector<Annotation> &list);
     void parseStrings(nlohmann::basic_json<> values, vector<string> &list);
     void parseEnclaves(nlohmann::basic_json<> values, vector<Enclave> &list);
+    void buildIndex();
 
-    string &getSourcePath() { 
+    const string &getSourcePath() const { 
         return this->sourcePath; 
     }
 
-    vector<Enclave> &getEnclaves() { 
+    const vector<Enclave> &getEnclaves() const { 
         return this->enclaves; 
     }
     
-    vector<string> &getLevels() {
+    const vector<string> &getLevels() const {
         return this->levels; 
     }
 
-    vector<Annotation> &getFunctions() { 
+    const vector<Annotation> &getFunctions() const { 
         return this->functions; 
     }
 
-    vector<Annotation> &getGlobalScopedVars() {
+    const vector<Annotation> &getGlobalScopedVars() const {
         return this->globalScopedVars; 
     }
 
-    string &getOutputDir() {
-        return this->outputDir;
-    }
-
-    void setOutputDir(string &outputDir) {
-        this->outputDir = outputDir;
-    }
-
-    string &getFileInProcess() {
-        return this->fileInProcess;
+    const string &getRewriteSlice() const {
+        return this->rewriteSlice;
     }
 
-    void setFileInProcess(string fileInProcess) {
-        this->fileInProcess = fileInProcess;
+    const string &getLevelsSlice() const {
+        return this->levelsSlice;
     }
 
-    void setLevelInProgress(string levelInProgress) {
-        this->levelInProgress = levelInProgress;
+    const string &getOutputDir() const {
+        return this->outputDir;
     }
 
-    string &getLevelInProgress() {
-        return this->levelInProgress;
+    void setOutputDir(string &outputDir) {
+        this->outputDir = outputDir;
     }
 };
 
@@ -10,6 +10,7 @@
 #include "clang/Basic/SourceManager.h"
 #include "clang/Frontend/CompilerInstance.h"
 
+#include "FileContext.h"
 #include "Topology.h"
 
 using namespace clang;
@@ -18,10 +19,12 @@ class Visitor
     : public clang::RecursiveASTVisitor<Visitor> 
 {
 public:
-    explicit Visitor(const clang::CompilerInstance &compiler, Topology &topology)
+    explicit Visitor(const clang::CompilerInstance &compiler, const Topology &topology,
+                     FileContext &context)
        : ctx(&compiler.getASTContext()), 
          langOpts(compiler.getLangOpts()),
-         topology(topology) {
+         topology(topology),
+         context(context) {
             
         init();
     }
@@ -39,7 +42,8 @@ private:
     clang::ASTContext *ctx;
     clang::LangOptions langOpts;
     std::string outputDir;
-    Topology topology;
+    const Topology &topology;
+    FileContext &context;
     map<string, ofstream *> fds;
     
     void init();
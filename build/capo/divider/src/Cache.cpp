@@ -0,0 +1,177 @@
+#include <filesystem>
+#include <fstream>
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/xxhash.h"
+
+#include "nlohmann/json.hpp"
+
+#include "capo/Trace.h"
+
+#include "Cache.h"
+
+using json = nlohmann::json;
+namespace fs = std::filesystem;
+
+// bump whenever the divider changes its output for the same input, or the
+// dependencies it records (2: include search locations before each header)
+static const int MANIFEST_VERSION = 2;
+
+void Cache::load()
+{
+    if (!fs::exists(manifest))
+        return;
+
+    std::ifstream jStream(manifest);
+    json js = json::parse(jStream, nullptr, false);
+    if (js.is_discarded() || js.value("version", 0) != MANIFEST_VERSION)
+        return;
+
+    for (auto &el : js["files"].items()) {
+        auto val = el.value();
+        CacheEntry entry;
+        entry.key = val["key"].get<string>();
+        entry.seconds = val["seconds"].get<double>();
+        for (auto &dep : val["dependencies"].items())
+            entry.dependencies[dep.key()] = dep.value().get<string>();
+
+        previous[el.key()] = entry;
+    }
+}
+
+void Cache::save()
+{
+    json files = json::object();
+    for (auto &it : current) {
+        CacheEntry &entry = it.second;
+        files[it.first] = {
+            { "key", entry.key },
+            { "seconds", entry.seconds },
+            { "dependencies", entry.dependencies },
+        };
+    }
+
+    json js = {
+        { "version", MANIFEST_VERSION },
+        { "files", files },
+    };
+    writeIfChanged(manifest, js.dump(2) + "\n");
+}
+
+string Cache::hash(llvm::StringRef data)
+{
+    return llvm::utohexstr(llvm::xxHash64(data), /*LowerCase=*/true);
+}
+
+// An unreadable file hashes to the empty string, which never matches
+// the hash of an existing file. A dependency recorded while it did not exist
+// therefore misses once it is created.
+string Cache::hashFile(const string &path)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = fileHashes.find(path);
+        if (it != fileHashes.end())
+            return it->second;
+    }
+
+    string result;
+    auto buffer = llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+    if (buffer)
+        result = hash((*buffer)->getBuffer());
+
+    std::lock_guard<std::mutex> guard(lock);
+    fileHashes[path] = result;
+    return result;
+}
+
+bool Cache::lookup(const string &file, const string &key, const vector<string> &outputs)
+{
+    CacheEntry entry;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = previous.find(file);
+        if (it == previous.end() || it->second.key != key) {
+            misses++;
+            return false;
+        }
+        entry = it->second;
+    }
+
+    bool hit = true;
+    for (auto &dep : entry.dependencies) {
+        if (hashFile(dep.first) != dep.second) {
+            hit = false;
+            break;
+        }
+    }
+    for (const string &output : outputs) {
+        if (!hit || !fs::exists(output)) {
+            hit = false;
+            break;
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (!hit) {
+        misses++;
+        return false;
+    }
+    hits++;
+    savedSeconds += entry.seconds;
+    current[file] = entry;
+    return true;
+}
+
+void Cache::update(const string &file, const string &key, const set<string> &dependencies,
+                   double seconds)
+{
+    CacheEntry entry;
+    entry.key = key;
+    entry.seconds = seconds;
+    for (const string &dep : dependencies)
+        entry.dependencies[dep] = hashFile(dep);
+
+    std::lock_guard<std::mutex> guard(lock);
+    current[file] = entry;
+}
+
+void Cache::report(llvm::raw_ostream &os)
+{
+    os << "cache: " << hits << " hits, " << misses << " misses, "
+       << llvm::format("%.2f", savedSeconds) << "s saved\n";
+}
+
+bool writeIfChanged(const string &file, llvm::StringRef content)
+{
+    capo::trace::Scope scope("write", capo::trace::IO);
+    auto buffer = llvm::MemoryBuffer::getFile(file, /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+    if (buffer && (*buffer)->getBuffer() == content)
+        return false;
+
+    std::error_code error_code;
+    llvm::raw_fd_ostream outFile(file, error_code, llvm::sys::fs::OF_None);
+    outFile << content;
+    outFile.close();
+    return true;
+}
+
+bool copyIfChanged(const string &from, const string &to)
+{
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer = nullptr;
+    {
+        capo::trace::Scope scope("read", capo::trace::IO);
+        buffer = llvm::MemoryBuffer::getFile(from, /*IsText=*/false,
+                                             /*RequiresNullTerminator=*/false);
+    }
+    if (!buffer) {
+        fs::copy_file(from, to, fs::copy_options::overwrite_existing);
+        return true;
+    }
+    return writeIfChanged(to, (*buffer)->getBuffer());
+}
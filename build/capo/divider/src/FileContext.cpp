@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <iterator>
+#include <map>
+
+#include "FileContext.h"
+
+void FileContext::addCleRangeOpen(SourceRange range, string pragma) 
+{
+    cleRange.push_back(ClePair(range, range, pragma));
+}
+
+void FileContext::addCleRangeClose(SourceRange range, string pragma) 
+{
+    if (cleRange.size() <= 0) {
+         log() << "ERROR: missing CLE begin\n";
+         return;
+    }
+    ClePair &last = cleRange[cleRange.size() - 1];
+    string pragma_begin = last.getPragma();
+    if (pragma_begin.find("#pragma cle begin ") == string::npos) {
+        log() << "ERROR: pragma not matched: " << pragma_begin << " v.s. " << pragma << "\n";
+        return;
+    }
+    string name_begin = pragma_begin.substr(pragma_begin.find_last_of(" "));
+    string name_end = pragma.substr(pragma.find_last_of(" "));
+
+    if (name_begin.compare(name_end)) {
+        log() << "ERROR: unmatched pragmas: " << pragma_begin << " v.s. " << pragma << "\n";
+    }
+    last.setEnd(range);
+}
+
+void FileContext::buildCleIndex(const SourceManager &sm)
+{
+    // pair i encloses the lines (open, close), exclusive
+    map<int, vector<int>> opens;
+    map<int, vector<int>> closes;
+    set<int> lines;
+    for (size_t i = 0; i < cleRange.size(); i++) {
+        int lineOpen = sm.getSpellingLineNumber(cleRange[i].getBegin().getBegin());
+        int lineClose = sm.getSpellingLineNumber(cleRange[i].getEnd().getBegin());
+        if (lineOpen + 1 >= lineClose)
+            continue;
+        opens[lineOpen + 1].push_back(i);
+        closes[lineClose].push_back(i);
+        lines.insert(lineOpen + 1);
+        lines.insert(lineClose);
+    }
+
+    set<int> active;
+    for (int line : lines) {
+        for (int i : closes[line])
+            active.erase(i);
+        for (int i : opens[line])
+            active.insert(i);
+        cleIndex.push_back({ line, active.empty() ? -1 : *active.begin() });
+    }
+    cleIndexed = true;
+}
+
+int FileContext::findEnclosingCle(const SourceManager &sm, int line)
+{
+    if (!cleIndexed)
+        buildCleIndex(sm);
+
+    auto it = std::upper_bound(cleIndex.begin(), cleIndex.end(), line,
+                               [](int line, const pair<int, int> &segment) {
+                                   return line < segment.first;
+                               });
+    if (it == cleIndex.begin())
+        return -1;
+    return std::prev(it)->second;
+}
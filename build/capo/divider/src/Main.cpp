@@ -1,4 +1,6 @@
+#include <atomic>
 #include <iostream>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
 
@@ -6,13 +8,18 @@
 #include "clang/Frontend/FrontendPluginRegistry.h"
 #include "clang/Tooling/CommonOptionsParser.h"
 #include "clang/Tooling/Tooling.h"
-#include "clang/Tooling/Refactoring.h"
 
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/VirtualFileSystem.h"
 #include "llvm/Support/WithColor.h"
-#include "llvm/Support/ToolOutputFile.h"
 
+#include "capo/Trace.h"
+
+#include "Cache.h"
+#include "FileContext.h"
 #include "Matcher.h"
-#include "PPFrontendAction.h"
+#include "PPCallbacksClosure.h"
 #include "Topology.h"
 
 using namespace llvm;
@@ -43,11 +50,28 @@ static cl::opt<std::string> outputDir {
     cl::cat(ClosureDividerCategory)
 };
 
-static cl::opt<std::string> OutputFileName(
-    "output", cl::init("-"),
-    cl::desc("Output trace to the given file name or '-' for stdout."),
-    cl::cat(ClosureDividerCategory));
+static cl::opt<unsigned> Jobs {
+    "j",
+    cl::desc("number of files divided in parallel (0 = all cores)"),
+    cl::init(1), 
+    cl::cat(ClosureDividerCategory)
+};
+
+static cl::opt<bool> Incremental {
+    "incremental",
+    cl::desc("skip the files whose divided output is unchanged since the last run"),
+    cl::init(false), 
+    cl::cat(ClosureDividerCategory)
+};
 
+static cl::opt<std::string> TraceFile {
+    "trace",
+    cl::desc("write the phase timings and peak RSS to this Chrome trace JSON file"),
+    cl::init(""), 
+    cl::cat(ClosureDividerCategory)
+};
+
+// read-only once parsed; shared by all jobs
 static Topology topology;
 
 [[noreturn]] static void error(Twine Message) {
@@ -55,9 +79,16 @@ static Topology topology;
     exit(1);
 }
 
+// Collects the #pragma cle begin/end pairs and rewrites every level
+// from a single front-end run over the file.
 class ClosurePluginAction : public PluginASTAction 
 {
 public:
+    explicit ClosurePluginAction(const clang::pp_divider::FilterType &filters,
+                                 FileContext &context)
+        : filters(filters), context(context) {
+    }
+
     bool ParseArgs(const CompilerInstance &CI,
                    const std::vector<std::string> &args) override {
         return true;
@@ -65,18 +96,34 @@ public:
 
     std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
                                                    StringRef file) override {
-        rewriter.setSourceMgr(CI.getSourceManager(),
-                                         CI.getLangOpts());
-        // return std::make_unique<ClosureDividerASTConsumer>(
-        //     CI, topology, MainTuOnly,
-        //     RewriterForCodeRefactor, ClassNameOpt, OldNameOpt, NewNameOpt);
+        Preprocessor &preprocessor = CI.getPreprocessor();
+        preprocessor.addPPCallbacks(
+            std::make_unique<clang::pp_divider::PPCallbacksClosure>(filters, preprocessor, context));
 
         return std::make_unique<MatcherASTConsumer>(
-            CI, topology, MainTuOnly, rewriter);
+            CI, topology, context, MainTuOnly);
     }
 
 private:
-    Rewriter rewriter;
+    const clang::pp_divider::FilterType &filters;
+    FileContext &context;
+};
+
+class ClosurePluginActionFactory : public tooling::FrontendActionFactory 
+{
+public:
+    explicit ClosurePluginActionFactory(const clang::pp_divider::FilterType &filters,
+                                        FileContext &context)
+        : filters(filters), context(context) {
+    }
+
+    std::unique_ptr<FrontendAction> create() override {
+        return std::make_unique<ClosurePluginAction>(filters, context);
+    }
+
+private:
+    const clang::pp_divider::FilterType &filters;
+    FileContext &context;
 };
 
 bool isInterested(fs::path path)
@@ -92,7 +139,8 @@ bool isInterested(fs::path path)
            !extension.compare(".hpp");
 }
 
-string createTargetDir(string &sourcePath, string &out_dir, string &level, fs::path &path)
+string createTargetDir(const string &sourcePath, const string &out_dir, const string &level, 
+                       const fs::path &path)
 {
     string fullpath = path.generic_string();
     string suffix = fullpath.substr(sourcePath.length() + 1);
@@ -109,9 +157,36 @@ string createTargetDir(string &sourcePath, string &out_dir, string &level, fs::p
     return suffix;
 }
 
-void divide(clang::tooling::CompilationDatabase &database, string topologyJson)
+// the compilation-database command line the file is parsed with
+string getCommandLine(clang::tooling::CompilationDatabase &database, const string &file)
+{
+    string commandLine;
+    for (auto &command : database.getCompileCommands(file)) {
+        commandLine += command.Directory + "\n";
+        for (auto &arg : command.CommandLine)
+            commandLine += arg + "\n";
+    }
+    return commandLine;
+}
+
+// An exception in a job is reported with the messages of its file and
+// fails the run, instead of being lost in the pool.
+static void fail(FileContext &context, std::atomic<bool> &failed, const std::exception &e)
+{
+    context.log() << "\t \terror: " << e.what() << "\n";
+    failed = true;
+}
+
+// false if dividing a file failed
+bool divide(clang::tooling::CompilationDatabase &database, string topologyJson)
 {
-    topology.parse(topologyJson);
+    if (!TraceFile.empty())
+        capo::trace::enable(TraceFile, "divider");
+
+    {
+        capo::trace::Scope scope("topology", capo::trace::PARSE, topologyJson);
+        topology.parse(topologyJson);
+    }
     topology.setOutputDir(outputDir);
 
     // for (auto level : topology.getLevels()) {
@@ -135,46 +210,138 @@ void divide(clang::tooling::CompilationDatabase &database, string topologyJson)
     else
         error(toString(Pat.takeError()));
 
-    std::error_code EC;
-    llvm::ToolOutputFile Out(OutputFileName, EC, llvm::sys::fs::OF_TextWithCRLF);
-    if (EC) 
-        error(EC.message());
-
-    for (string level : topology.getLevels()) {
+    const vector<string> &levels = topology.getLevels();
+    for (const string &level : levels)
         llvm::outs() << outputDir << "/" << level << "\n";
-        topology.setLevelInProgress(level);
-
-        for (auto& pit: fs::recursive_directory_iterator(sourcePath)) {
-            fs::path path = pit.path();
-            if (is_directory(pit))
-                continue;
-
-            // suffix is a path starting from the point after the output directory
-            // it is used in Matcher::isInFile()
-            string suffix = createTargetDir(sourcePath, outputDir, level, path);
-            topology.setFileInProcess(suffix);
-
-            std::cout << "\t " << path.generic_string() << std::endl;
-            if (!isInterested(path)) {
-                fs::copy_file(path, topology.getOutputFile(), fs::copy_options::overwrite_existing);
-                continue;
-            }
-            vector<string> cxxfile = { path.generic_string() };
 
-            // clang::tooling::ClangTool tool(database, cxxfile);
-            // tool.run(clang::tooling::newFrontendActionFactory<ClosurePluginAction>().get());
+    // Sorted, so that the order of the messages does not depend on the
+    // file system or on the number of jobs.
+    vector<fs::path> paths;
+    for (auto& pit: fs::recursive_directory_iterator(sourcePath)) {
+        if (!is_directory(pit))
+            paths.push_back(pit.path());
+    }
+    std::sort(paths.begin(), paths.end());
+
+    // suffix is a path starting from the point after the output directory
+    // it is used in Matcher::isInFile()
+    vector<std::unique_ptr<FileContext>> contexts;
+    for (fs::path &path : paths) {
+        string suffix;
+        for (const string &level : levels)
+            suffix = createTargetDir(sourcePath, outputDir, level, path);
+        contexts.push_back(std::make_unique<FileContext>(suffix));
+    }
+
+    std::unique_ptr<Cache> cache;
+    if (Incremental) {
+        capo::trace::Scope scope("cache load", capo::trace::IO);
+        // one manifest per source tree, as several trees may share an output
+        // directory (by default /tmp)
+        string key = Cache::hash(fs::absolute(sourcePath).lexically_normal().generic_string());
+        cache = std::make_unique<Cache>(outputDir + "/.divider-cache-" + key + ".json");
+        cache->load();
+    }
 
-            Matcher::clearCleRange();
+    // Each file is parsed once; the #pragma cle pairs are collected by the
+    // preprocessor callback and all levels are rewritten from the same AST.
+    // Every job writes only its own output files, so the result does not
+    // depend on the number of jobs.
+    ThreadPool pool(hardware_concurrency(Jobs));
+    vector<std::shared_future<void>> jobs;
+    std::atomic<bool> failed { false };
+    for (size_t i = 0; i < paths.size(); i++) {
+        fs::path &path = paths[i];
+        FileContext &context = *contexts[i];
+
+        vector<string> outputs;
+        for (const string &level : levels)
+            outputs.push_back(topology.getOutputFile(level, context.getFileInProcess()));
+
+        if (!isInterested(path)) {
+            jobs.push_back(pool.async([&cache, &path, &context, &failed, outputs]() {
+                try {
+                    capo::trace::Scope scope("copy", capo::trace::TOOL, context.getFileInProcess());
+                    context.log() << "\t " << path.generic_string() << "\n";
+                    string key;
+                    if (cache) {
+                        key = Cache::hash(cache->hashFile(path.generic_string()) + "\n" +
+                                          topology.getLevelsSlice());
+                        if (cache->lookup(context.getFileInProcess(), key, outputs))
+                            return;
+                    }
+
+                    auto start = std::chrono::steady_clock::now();
+                    for (const string &output : outputs)
+                        copyIfChanged(path.generic_string(), output);
+
+                    if (cache) {
+                        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                        cache->update(context.getFileInProcess(), key, {}, elapsed.count());
+                    }
+                } catch (const std::exception &e) {
+                    fail(context, failed, e);
+                }
+            }));
+            continue;
+        }
 
-            // run the preprocessor callback to get the #pragma begin/end pair
-            clang::tooling::ClangTool Toolx(database, cxxfile);
-            PPFrontendActionFactory Factory(filters, Out.os());
-            Toolx.run(&Factory);
-           
-            clang::tooling::RefactoringTool Tool(database, cxxfile);
-            Tool.runAndSave(clang::tooling::newFrontendActionFactory<ClosurePluginAction>().get());
+        jobs.push_back(pool.async([&database, &filters, &cache, &path, &context, &failed, outputs]() {
+            try {
+                capo::trace::Scope scope("divide", capo::trace::TOOL, context.getFileInProcess());
+                context.log() << "\t " << path.generic_string() << "\n";
+                vector<string> cxxfile = { path.generic_string() };
+
+                // The key covers the file itself; the headers it includes are
+                // only known after parsing and are checked by Cache::lookup().
+                string key;
+                if (cache) {
+                    key = Cache::hash(cache->hashFile(path.generic_string()) + "\n" +
+                                      topology.getRewriteSlice() + "\n" +
+                                      getCommandLine(database, path.generic_string()));
+                    if (cache->lookup(context.getFileInProcess(), key, outputs)) {
+                        context.log() << "\t \tunchanged\n";
+                        return;
+                    }
+                }
+                auto start = std::chrono::steady_clock::now();
+
+                // Each job gets its own VFS so that concurrent tools do not
+                // share a working directory.
+                clang::tooling::ClangTool Tool(database, cxxfile,
+                    std::make_shared<PCHContainerOperations>(),
+                    llvm::vfs::createPhysicalFileSystem());
+                ClosurePluginActionFactory Factory(filters, context);
+                int status = Tool.run(&Factory);
+
+                // a file that failed to parse is divided again on the next run
+                if (cache && status == 0) {
+                    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                    cache->update(context.getFileInProcess(), key, context.getDependencies(),
+                                  elapsed.count());
+                }
+            } catch (const std::exception &e) {
+                fail(context, failed, e);
+            }
+        }));
+    }
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+        jobs[i].get();
+        llvm::outs() << contexts[i]->getMessages();
+        llvm::outs().flush();
+    }
+
+    if (cache) {
+        {
+            capo::trace::Scope scope("cache save", capo::trace::IO);
+            cache->save();
         }
+        cache->report(llvm::outs());
     }
+
+    capo::trace::finish();
+    return !failed;
 }
 
 int main(int argc, const char **argv) 
@@ -193,7 +360,8 @@ int main(int argc, const char **argv)
     // The first positional arugment is assumed to the topology.json.
     // Ideally it should be specified with a command line option. 
     // However, running the plugin without positional arguments leads to crash.
-    divide(eOptParser->getCompilations(), eOptParser->getSourcePathList()[0]);
+    if (!divide(eOptParser->getCompilations(), eOptParser->getSourcePathList()[0]))
+        return EXIT_FAILURE;
 
     return 0;
 }
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <regex>
 #include <fstream>
@@ -9,6 +10,7 @@
 #include "clang/Sema/Sema.h"
 
 #include "Attr.h"
+#include "Cache.h"
 #include "Matcher.h"
 #include "Topology.h"
 
@@ -16,17 +18,18 @@ using namespace clang;
 using namespace std;
 using namespace ast_matchers;
 
-vector<ClePair> Matcher::cleRange;
-
 MatcherASTConsumer::MatcherASTConsumer(
     clang::CompilerInstance &compiler,
-    Topology &topology,
-    bool mainFileOnly, 
-    clang::Rewriter &rewriter)
+    const Topology &topology,
+    FileContext &context,
+    bool mainFileOnly)
     : sm(compiler.getSourceManager()), 
       mainTUOnly(mainFileOnly),
-      matcherHandler(compiler, rewriter, topology) 
+      matcherHandler(topology, context)
 {
+    for (const string &level : topology.getLevels())
+        matcherHandler.addMatcher(std::make_unique<Matcher>(compiler, topology, context, level));
+
     const auto matcherForMemberAccess = cxxMemberCallExpr(
         callee(memberExpr(member(hasName("oldName"))).bind("MemberAccess")),
         thisPointerType(cxxRecordDecl(isSameOrDerivedFrom(hasName("className")))));
@@ -43,32 +46,14 @@ MatcherASTConsumer::MatcherASTConsumer(
         // hasDescendant(cxxMethodDecl(hasName(oldName)))).bind("method");
     // const auto functionDecl(hasDescendant(callExpr().bind("functionCall")));
 
-    // const auto funcDecl = functionDecl().bind("FunctionDecl");
-    // finder.addMatcher(funcDecl, &matcherHandler);
-
-    for (Annotation annotation: topology.getFunctions()) {
-        // llvm::outs() << "#### " << annotation.getName() << "\n";
-        string funcName = annotation.getName();
-        const auto funcDecl = functionDecl(hasName(funcName)).bind("FunctionDecl");
-        finder.addMatcher(funcDecl, &matcherHandler);
+    // One matcher per kind; Matcher::run() looks the names up in the
+    // topology index instead of registering one matcher per annotation.
+    const auto funcDecl = functionDecl().bind("FunctionDecl");
+    finder.addMatcher(funcDecl, &matcherHandler);
 
-        // const auto funcCall = callExpr(callee(functionDecl(hasName(funcName)))).bind("FunctionCall");
-        // finder.addMatcher(funcCall, &matcherHandler);
-    }
-    // const auto funcCall = callExpr(callee(functionDecl(hasName(annotation.getName()))),
-    //                                    argumentCountIs(0)).bind("FunctionCall");
-
-    for (Annotation annotation: topology.getGlobalScopedVars()) {
-        string varName = annotation.getName();
-        const auto vDecl = varDecl(hasName(varName), 
-                                   hasGlobalStorage(),
-                                   isDefinition()).bind("VarDecl");
-        finder.addMatcher(vDecl, &matcherHandler);
-
-        // const auto varRef = declRefExpr(varDecl(hasName(varName))).bind("varRef");
-        // const auto varRef =  declRefExpr(to(varDecl(hasName(varName)))).bind("VarRef");
-        // finder.addMatcher(varRef, &matcherHandler);
-    }
+    const auto vDecl = varDecl(hasGlobalStorage(),
+                               isDefinition()).bind("VarDecl");
+    finder.addMatcher(vDecl, &matcherHandler);
 
     const auto fdDecl = fieldDecl().bind("FieldDecl");
     finder.addMatcher(fdDecl, &matcherHandler);
@@ -80,12 +65,32 @@ MatcherASTConsumer::MatcherASTConsumer(
     finder.addMatcher(recordDecl, &matcherHandler);
 }
 
-void Matcher::run(const MatchFinder::MatchResult &result) 
+void LevelDispatcher::run(const MatchFinder::MatchResult &result)
+{
+    const clang::SourceManager &sm = *result.SourceManager;
+    const string &file = context.getFileInProcess();
+
+    // the cheap file check first: most decls come from included headers
+    AnnotatedDecls annotated;
+    const FunctionDecl *func = result.Nodes.getNodeAs<clang::FunctionDecl>("FunctionDecl");
+    if (func && isInFile(sm, func, file) && isAnnotated(func, true))
+        annotated.func = func;
+
+    const VarDecl *var = result.Nodes.getNodeAs<clang::VarDecl>("VarDecl");
+    if (var && !var->isLocalVarDecl() && isInFile(sm, var, file) && isAnnotated(var, false))
+        annotated.var = var;
+
+    for (auto &matcher : matchers)
+        matcher->run(result, annotated);
+}
+
+void Matcher::run(const MatchFinder::MatchResult &result, const AnnotatedDecls &annotated) 
 {
     const clang::SourceManager &sm = *result.SourceManager;
 
     const MemberExpr *memberAccess = result.Nodes.getNodeAs<clang::MemberExpr>("MemberAccess");
     if (memberAccess) {
+        capo::trace::Total::Piece piece(rewriting);
         // printf("access............\n");
         SourceRange callExprSrcRange = memberAccess->getMemberLoc();
         rewriter.ReplaceText(callExprSrcRange, "XXX");
@@ -95,13 +100,13 @@ void Matcher::run(const MatchFinder::MatchResult &result)
     if (memberDecl && isInFile(sm, memberDecl)) {
         showLoc("decl", sm, memberDecl);
 
+        capo::trace::Total::Piece piece(rewriting);
         SourceRange memberDeclSrcRange = memberDecl->getLocation();
         rewriter.ReplaceText(CharSourceRange::getTokenRange(memberDeclSrcRange), "XXX");
     }
 
-    const FunctionDecl *func = result.Nodes.getNodeAs<clang::FunctionDecl>("FunctionDecl");
-    if (func && isInFile(sm, func)) {  // func->hasAttrs() && 
-        matchFunctionDecl(sm, func);
+    if (annotated.func) {
+        matchFunctionDecl(sm, annotated.func);
     }
 
     // const CallExpr *call = result.Nodes.getNodeAs<clang::CallExpr>("FunctionCall");
@@ -109,9 +114,8 @@ void Matcher::run(const MatchFinder::MatchResult &result)
     //     matchFunctionCall(sm, call);
     // }
 
-    const VarDecl *var = result.Nodes.getNodeAs<clang::VarDecl>("VarDecl");
-    if (var && isInFile(sm, var) && !var->isLocalVarDecl()) { // && var->hasAttrs() ) {
-        matchVarDecl(sm, var); 
+    if (annotated.var) {
+        matchVarDecl(sm, annotated.var); 
     }
 
     // const DeclRefExpr *varRef = result.Nodes.getNodeAs<clang::DeclRefExpr>("VarRef");
@@ -137,16 +141,55 @@ void Matcher::run(const MatchFinder::MatchResult &result)
     }
 }
 
+// Whether hasName() would match the decl against one of the annotated
+// function or global variable names of the topology.
+bool LevelDispatcher::isAnnotated(const NamedDecl *decl, bool function)
+{
+    string name = decl->getNameAsString();
+    if (function ? topology.isFunction(name) : topology.isGlobalScopedVar(name))
+        return true;
+
+    // only the qualified names ending in this one can match
+    const vector<string> *qualified = function ? topology.getQualifiedFunctionNames(name)
+                                               : topology.getQualifiedGlobalScopedVarNames(name);
+    if (!qualified)
+        return false;
+
+    // the enclosing scopes as hasName() names them; extern "C" blocks and
+    // unscoped enums do not count
+    vector<NameScope> scopes;
+    for (const DeclContext *ctx = decl->getDeclContext(); ctx && !ctx->isTranslationUnit();
+         ctx = ctx->getParent()) {
+        if (ctx->isTransparentContext())
+            continue;
+        if (const auto *ns = dyn_cast<NamespaceDecl>(ctx)) {
+            scopes.push_back({ ns->isAnonymousNamespace() ? "(anonymous namespace)"
+                                                          : ns->getNameAsString(),
+                               ns->isInline() });
+        } else if (const auto *named = dyn_cast<NamedDecl>(Decl::castFromDeclContext(ctx))) {
+            string scopeName = named->getNameAsString();
+            scopes.push_back({ scopeName.empty() ? "(anonymous)" : scopeName, false });
+        }
+    }
+    std::reverse(scopes.begin(), scopes.end());
+
+    for (const string &pattern : *qualified) {
+        if (Topology::matchesName(pattern, scopes, name))
+            return true;
+    }
+    return false;
+}
+
 bool Matcher::matchFunctionDecl(const clang::SourceManager &sm, const FunctionDecl *func)
 {
-    string &level = topology.getLevelInProgress();
     string funcName = func->getNameInfo().getAsString();
 
-    if (topology.isNameInLevel(funcName, level))
+    if (topology.isNameInLevel(funcName, levelId))
         return true;    // keep it
 
     // showLoc("FunctionDecl......", sm, func);
 
+    capo::trace::Total::Piece piece(rewriting);
     const FunctionDecl* def = NULL;
     func->hasBody(def);
     // if (!func->hasBody(def))
@@ -155,7 +198,7 @@ bool Matcher::matchFunctionDecl(const clang::SourceManager &sm, const FunctionDe
     SourceRange range = func->getSourceRange();
     int idx = isEnclosedInCle(range);
     if (idx >= 0) {
-        ClePair clePair = cleRange[idx];
+        ClePair clePair = context.getCleRange()[idx];
         replace(sm, clePair.getBegin());
         replace(sm, clePair.getEnd());
     }
@@ -183,9 +226,8 @@ bool Matcher::matchFunctionCall(const clang::SourceManager &sm, const CallExpr *
 {
     const FunctionDecl *callee = call->getDirectCallee();
     string funcName = callee->getNameInfo().getAsString();
-    string &level = topology.getLevelInProgress();
 
-    if (topology.isNameInLevel(funcName, level))
+    if (topology.isNameInLevel(funcName, levelId))
         return true;    // keep it
 
     SourceRange range = call->getSourceRange();
@@ -198,6 +240,7 @@ bool Matcher::matchFunctionCall(const clang::SourceManager &sm, const CallExpr *
         }
     }
     if (!erased) {
+        capo::trace::Total::Piece piece(rewriting);
         // showLoc("FunctionCall......", sm, call);
         StringRef prefix("_err_handler_rpc_");
         rewriter.InsertTextBefore(call->getBeginLoc(), prefix);
@@ -207,19 +250,19 @@ bool Matcher::matchFunctionCall(const clang::SourceManager &sm, const CallExpr *
 
 bool Matcher::matchVarDecl(const clang::SourceManager &sm, const VarDecl *var)
 {
-    string &level = topology.getLevelInProgress();
     string varName = var->getName().str();
 
-    if (topology.isNameInLevel(varName, level))
+    if (topology.isNameInLevel(varName, levelId))
         return true;    // keep it
 
+    capo::trace::Total::Piece piece(rewriting);
     SourceRange range = var->getSourceRange();
 
     // showLoc("VarDecl......", sm, var);
 
     int idx = isEnclosedInCle(range);
     if (idx >= 0) {
-        ClePair clePair = cleRange[idx];
+        ClePair clePair = context.getCleRange()[idx];
         replace(sm, clePair.getBegin());
         replace(sm, clePair.getEnd());
     }
@@ -236,11 +279,10 @@ bool Matcher::matchVarRef(const clang::SourceManager &sm, const DeclRefExpr *var
 {
     return true;  // TODO
 
-    string &level = topology.getLevelInProgress();
     string varName = varRef->getNameInfo().getAsString();
 
     showLoc("VarRef......", sm, varRef);
-    if (topology.isNameInLevel(varName, level))
+    if (topology.isNameInLevel(varName, levelId))
         return true;    // keep it
 
     SourceRange range = varRef->getSourceRange();
@@ -249,7 +291,7 @@ bool Matcher::matchVarRef(const clang::SourceManager &sm, const DeclRefExpr *var
     std::string original = rewriter.getRewrittenText(range);
     
     // TODO: not complete because of the crash above
-    llvm::outs() << Lexer::getSourceText(CharSourceRange::getTokenRange(range), sm, langOpts).str() << "\n";   
+    context.log() << Lexer::getSourceText(CharSourceRange::getTokenRange(range), sm, langOpts).str() << "\n";   
 
     StringRef prefix("_err_handler_rpc_");
     rewriter.InsertTextBefore(varRef->getBeginLoc(), prefix);
@@ -259,13 +301,13 @@ bool Matcher::matchVarRef(const clang::SourceManager &sm, const DeclRefExpr *var
 
 bool Matcher::matchRecordDecl(const clang::SourceManager &sm, const CXXRecordDecl *record)
 {
-    string &level = topology.getLevelInProgress();
     string className = record->getNameAsString();
 
-    if (topology.isInEnclave(className, level) || !record->hasDefinition())
+    if (topology.isInEnclave(className, levelId) || !record->hasDefinition())
         return true;    // keep it
 
     // showLoc("RecordDecl......", sm, record);
+    capo::trace::Total::Piece piece(rewriting);
     replace(sm, record->getSourceRange());
 
     SourceLocation loc = findSemiAfterLocation(record->getEndLoc(), *ctx, true);
@@ -317,22 +359,28 @@ SourceLocation Matcher::findSemiAfterLocation(SourceLocation loc,
 
 void Matcher::onEndOfTranslationUnit() 
 {
-    string file = topology.getOutputFile();
-    llvm::outs() << "\t \t" << file << "\n";
-
-    std::error_code error_code;
-    llvm::raw_fd_ostream outFile(file, error_code, llvm::sys::fs::OF_None);
-    rewriter.getEditBuffer(rewriter.getSourceMgr().getMainFileID()).write(outFile);
-    outFile.close();
+    string file = topology.getOutputFile(level, context.getFileInProcess());
+    context.log() << "\t \t" << file << "\n";
+
+    // still within the "matching" scope that made the edits
+    rewriting.record(level);
+
+    // unchanged outputs are left alone, keeping their modification time
+    std::string content;
+    llvm::raw_string_ostream contentStream(content);
+    {
+        capo::trace::Scope scope("rewritten buffer", capo::trace::REWRITE, level);
+        rewriter.getEditBuffer(rewriter.getSourceMgr().getMainFileID()).write(contentStream);
+    }
+    writeIfChanged(file, contentStream.str());
 
     // rewriter.getEditBuffer(rewriter.getSourceMgr().getMainFileID())
     //         .write(llvm::outs());
 }
 
-bool Matcher::isInFile(const clang::SourceManager &sm, const Decl *decl)
+bool isInFile(const clang::SourceManager &sm, const Decl *decl, const string &target)
 {
     string file = sm.getFilename(decl->getLocation()).str();
-    string &target = topology.getFileInProcess();
 
     return (file.length() >= target.length() &&
             !file.compare(file.length() - target.length(), target.length(), target));
@@ -342,45 +390,7 @@ int Matcher::isEnclosedInCle(SourceRange &range)
 {
     int line = sm.getSpellingLineNumber(range.getBegin());
 
-    for (size_t i = 0; i < cleRange.size(); i++) {
-        ClePair clePair = cleRange[i];
-        SourceRange open = clePair.getBegin();
-        int lineOpen = sm.getSpellingLineNumber(open.getBegin());
-
-        SourceRange close = clePair.getEnd();
-        int lineClose = sm.getSpellingLineNumber(close.getBegin());
-
-        if (line > lineOpen && line < lineClose) {
-            return i;
-        }
-    }
-    return -1;
-}
-
-void Matcher::addCleRangeOpen(SourceRange range, string pragma) 
-{
-    cleRange.push_back(ClePair(range, range, pragma));
-}
-
-void Matcher::addCleRangeClose(SourceRange range, string pragma) 
-{
-    if (cleRange.size() <= 0) {
-         llvm::outs() << "ERROR: missing CLE begin\n";
-         return;
-    }
-    ClePair &last = cleRange[cleRange.size() - 1];
-    string pragma_begin = last.getPragma();
-    if (pragma_begin.find("#pragma cle begin ") == string::npos) {
-        llvm::outs() << "ERROR: pragma not matched: " << pragma_begin << " v.s. " << pragma << "\n";
-        return;
-    }
-    string name_begin = pragma_begin.substr(pragma_begin.find_last_of(" "));
-    string name_end = pragma.substr(pragma.find_last_of(" "));
-
-    if (name_begin.compare(name_end)) {
-        llvm::outs() << "ERROR: unmatched pragmas: " << pragma_begin << " v.s. " << pragma << "\n";
-    }
-    last.setEnd(range);
+    return context.findEnclosingCle(sm, line);
 }
 
 void Matcher::replace(const clang::SourceManager &sm, SourceRange range)
@@ -404,7 +414,7 @@ void Matcher::showLoc(string msg, const clang::SourceManager &sm, const Decl *de
 
     auto attr = decl->getAttr<clang::AnnotateAttr>();
     if (attr != nullptr)
-        std::cout << attr->getAnnotation().str() << std::endl;
+        context.log() << attr->getAnnotation() << "\n";
 }
 
 void Matcher::showLoc(string msg, const clang::SourceManager &sm, const Expr *expr)
@@ -449,11 +459,11 @@ static std::string getSourceLocationString(const clang::SourceManager &sm, Sourc
 void Matcher::showLoc(string msg, const clang::SourceManager &sm, 
     SourceLocation begin, SourceLocation end)
 {
-    llvm::outs() << msg 
-                 << getSourceLocationString(sm, begin, true)
-                 << "-"
-                 << getSourceLocationString(sm, end, false)
-                 << "\n";
+    context.log() << msg 
+                  << getSourceLocationString(sm, begin, true)
+                  << "-"
+                  << getSourceLocationString(sm, end, false)
+                  << "\n";
 }
 
 static ParsedAttrInfoRegistry::Add<AttrInfo> Y("cle", "cle annotator");
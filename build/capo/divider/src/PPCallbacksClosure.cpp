@@ -1,15 +1,20 @@
 #include "clang/Basic/FileManager.h"
+#include "clang/Lex/HeaderSearch.h"
 #include "clang/Lex/MacroArgs.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include "capo/Trace.h"
+
 #include "PPCallbacksClosure.h"
-#include "Matcher.h"
 
 namespace clang {
 namespace pp_divider {
 
-PPCallbacksClosure::PPCallbacksClosure(const FilterType &filters, Preprocessor &preprocessor)
-    : filters(filters), preprocessor(preprocessor) 
+PPCallbacksClosure::PPCallbacksClosure(const FilterType &filters, Preprocessor &preprocessor,
+                                       FileContext &context)
+    : filters(filters), preprocessor(preprocessor), context(context) 
 {
 }
 
@@ -20,6 +25,7 @@ PPCallbacksClosure::~PPCallbacksClosure()
 // invoked when start reading any pragma directive.
 void PPCallbacksClosure::PragmaDirective(SourceLocation loc, PragmaIntroducerKind introducer)
 {
+    capo::trace::Scope scope("pragma", capo::trace::PREPROCESS);
     SourceManager &sm = preprocessor.getSourceManager();
     unsigned line = sm.getExpansionLineNumber(loc);
     SourceLocation line_after = sm.translateLineCol(sm.getMainFileID(), line + 1, 1);
@@ -28,10 +34,63 @@ void PPCallbacksClosure::PragmaDirective(SourceLocation loc, PragmaIntroducerKin
 
     std::string pragma = getSourceString(csr).str();
     if (pragma.rfind("#pragma cle begin ", 0) == 0) {
-        Matcher::addCleRangeOpen(range, pragma);
+        context.addCleRangeOpen(range, pragma);
     }
     else if (pragma.rfind("#pragma cle end ", 0) == 0) {
-        Matcher::addCleRangeClose(range, pragma);
+        context.addCleRangeClose(range, pragma);
+    }
+}
+
+// invoked for every #include, including those of included headers;
+// the headers are recorded as dependencies for the divider cache.
+//
+// So are the places searched before the one the header was found in: a
+// header created there later would shadow it without changing any recorded
+// file. They do not exist now and hash to the empty string, so the cached
+// output is reused only while they stay absent. The search path itself is
+// part of the compile command, which is in the cache key. Header maps and
+// frameworks are not searched here; their headers are still recorded.
+void PPCallbacksClosure::InclusionDirective(SourceLocation hashLoc, const Token &includeTok,
+                                            StringRef fileName, bool isAngled,
+                                            CharSourceRange filenameRange, const FileEntry *file,
+                                            StringRef searchPath, StringRef relativePath,
+                                            const Module *imported,
+                                            SrcMgr::CharacteristicKind fileType)
+{
+    if (file == nullptr)
+        return;
+
+    capo::trace::Scope scope("include", capo::trace::PREPROCESS);
+    StringRef path = file->tryGetRealPathName();
+    context.addDependency((path.empty() ? file->getName() : path).str());
+
+    if (llvm::sys::path::is_absolute(fileName))
+        return;
+
+    FileManager &fm = preprocessor.getFileManager();
+    std::vector<std::string> dirs;
+    if (!isAngled) {
+        SourceManager &sm = preprocessor.getSourceManager();
+        const FileEntry *includer = sm.getFileEntryForID(sm.getFileID(sm.getExpansionLoc(hashLoc)));
+        if (includer)
+            dirs.push_back(llvm::sys::path::parent_path(includer->getName()).str());
+    }
+    HeaderSearch &headers = preprocessor.getHeaderSearchInfo();
+    for (auto it = isAngled ? headers.angled_dir_begin() : headers.search_dir_begin();
+         it != headers.search_dir_end(); ++it) {
+        if (it->isNormalDir())
+            dirs.push_back(it->getName().str());
+    }
+
+    for (const std::string &dir : dirs) {
+        SmallString<256> candidate(dir.empty() ? "." : dir);
+        llvm::sys::path::append(candidate, fileName);
+        auto found = fm.getFile(candidate);
+        if (found && *found == file)
+            break;
+        fm.makeAbsolutePath(candidate);
+        llvm::sys::path::remove_dots(candidate, /*remove_dot_dot=*/true);
+        context.addDependency(candidate.str().str());
     }
 }
 
@@ -15,6 +15,11 @@ void Topology::parse(string &topology)
     json js;
     jStream >> js;
 
+    json rewrite = js;
+    rewrite.erase("source_path");
+    rewriteSlice = rewrite.dump();
+    levelsSlice = js["levels"].dump();
+
     for (auto &el : js.items()) {
         string key = el.key();
         auto val = el.value();
@@ -38,6 +43,97 @@ void Topology::parse(string &topology)
             std::cout << "ERROR: unknown key: " << key << endl;
         }
     }
+
+    buildIndex();
+}
+
+static uint32_t intern(unordered_map<string, uint32_t> &ids, const string &name)
+{
+    return ids.emplace(name, (uint32_t) ids.size()).first->second;
+}
+
+static uint64_t pairKey(uint32_t levelId, uint32_t nameId)
+{
+    return ((uint64_t) levelId << 32) | nameId;
+}
+
+void Topology::buildIndex()
+{
+    for (string &level : levels)
+        intern(levelIds, level);
+
+    for (auto &it : allAnnotations) {
+        uint32_t levelId = intern(levelIds, it.first);
+        for (auto &it2 : it.second)
+            namesInLevel.insert(pairKey(levelId, intern(nameIds, it2.first)));
+    }
+
+    for (Enclave &enclave : enclaves) {
+        uint32_t levelId = intern(levelIds, enclave.getLevel());
+        for (string &assigned : enclave.getAssignedClasses())
+            classesInLevel.insert(pairKey(levelId, intern(nameIds, assigned)));
+    }
+
+    for (Annotation &annotation : functions) {
+        string &name = annotation.getName();
+        size_t last = name.rfind("::");
+        if (last == string::npos)
+            functionNames.insert(name);
+        else
+            qualifiedFunctionNames[name.substr(last + 2)].push_back(name);
+    }
+
+    for (Annotation &annotation : globalScopedVars) {
+        string &name = annotation.getName();
+        size_t last = name.rfind("::");
+        if (last == string::npos)
+            globalScopedVarNames.insert(name);
+        else
+            qualifiedGlobalScopedVarNames[name.substr(last + 2)].push_back(name);
+    }
+}
+
+// Whether the first count parts of a qualified name match the first depth
+// scopes, skipping inline namespaces; unanchored, any outer scopes may remain
+static bool matchesScopes(const vector<string> &parts, size_t count,
+                          const vector<NameScope> &scopes, size_t depth, bool anchored)
+{
+    if (count == 0) {
+        if (anchored) {
+            for (size_t i = 0; i < depth; i++) {
+                if (!scopes[i].isInline)
+                    return false;
+            }
+        }
+        return true;
+    }
+    if (depth == 0)
+        return false;
+
+    const NameScope &scope = scopes[depth - 1];
+    if (scope.name == parts[count - 1] &&
+        matchesScopes(parts, count - 1, scopes, depth - 1, anchored))
+        return true;
+    return scope.isInline && matchesScopes(parts, count, scopes, depth - 1, anchored);
+}
+
+bool Topology::matchesName(const string &pattern, const vector<NameScope> &scopes,
+                           const string &name)
+{
+    bool anchored = pattern.rfind("::", 0) == 0;
+    vector<string> parts;
+    for (size_t start = anchored ? 2 : 0;;) {
+        size_t end = pattern.find("::", start);
+        parts.push_back(pattern.substr(start, end == string::npos ? string::npos : end - start));
+        if (end == string::npos)
+            break;
+        start = end + 2;
+    }
+
+    if (parts.back() != name)
+        return false;
+    parts.pop_back();
+    return matchesScopes(parts, parts.size(), scopes, scopes.size(), anchored);
 }
 
 void Topology::parseAnnotations(nlohmann::basic_json<> values, vector<Annotation> &list)
@@ -86,31 +182,36 @@ void Topology::parseStrings(nlohmann::basic_json<> values, vector<string> &list)
     } 
 }
 
-bool Topology::isNameInLevel(string &name, string &level)
+int Topology::getLevelId(const string &level) const
+{
+    auto it = levelIds.find(level);
+    return it == levelIds.end() ? -1 : (int) it->second;
+}
+
+bool Topology::isNameInLevel(const string &name, int levelId) const
 {
-    map<string, map<string, Annotation>>::iterator it = allAnnotations.find(level);
-    if (it == allAnnotations.end()) {  
+    auto it = nameIds.find(name);
+    if (levelId < 0 || it == nameIds.end())
         return false;
-    }
 
-    map<string, Annotation> &annoMap = it->second;
-    map<string, Annotation>::iterator it2 = annoMap.find(name);
-    if (it2 == annoMap.end())
+    return namesInLevel.count(pairKey(levelId, it->second)) > 0;
+}
+
+bool Topology::isInEnclave(const string &name, int levelId) const
+{
+    auto it = nameIds.find(name);
+    if (levelId < 0 || it == nameIds.end())
         return false;
-    else
-        return true;
+
+    return classesInLevel.count(pairKey(levelId, it->second)) > 0;
 }
 
-bool Topology::isInEnclave(string &name, string &level)
+bool Topology::isNameInLevel(const string &name, const string &level) const
 {
-    for (Enclave enclave : enclaves) {
-        if (enclave.getLevel().compare(level))
-            continue;
-        for (string assigned : enclave.getAssignedClasses()) {
-            if (!assigned.compare(name)) {
-                return true;
-            }
-        }
-    }
-    return false;
+    return isNameInLevel(name, getLevelId(level));
+}
+
+bool Topology::isInEnclave(const string &name, const string &level) const
+{
+    return isInEnclave(name, getLevelId(level));
 }
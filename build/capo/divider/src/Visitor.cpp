@@ -16,7 +16,7 @@ using namespace std;
 void Visitor::init()
 {
     for (auto level : topology.getLevels()) {
-        string file = topology.getOutputDir() + "/" + level + "/" + topology.getFileInProcess();
+        string file = topology.getOutputDir() + "/" + level + "/" + context.getFileInProcess();
 
         ofstream *fd = new ofstream();
         fd->open(file, ios::out | ios::trunc);
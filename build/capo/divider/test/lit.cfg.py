@@ -31,7 +31,7 @@ config.test_source_root = os.path.dirname(__file__)
 # excludes: A list of directories to exclude from the testsuite. The 'Inputs'
 # subdirectories contain auxiliary inputs for various tests in their parent
 # directories.
-config.excludes = ['Inputs']
+config.excludes = ['Inputs', 'unit']
 
 # The list of tools required for testing - prepend them with the path specified
 # during configuration (i.e. LT_LLVM_TOOLS_DIR/bin)
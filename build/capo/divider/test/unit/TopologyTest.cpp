@@ -0,0 +1,115 @@
+// Checks Topology::matchesName() against the hasName() semantics that the
+// divider's annotation matching replaces, and the name index it is fed from.
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+#include "Topology.h"
+
+static int failures = 0;
+
+static void check(bool expected, const string &pattern, const vector<NameScope> &scopes,
+                  const string &name)
+{
+    if (Topology::matchesName(pattern, scopes, name) == expected)
+        return;
+
+    string qualified;
+    for (const NameScope &scope : scopes)
+        qualified += scope.name + (scope.isInline ? "(inline)::" : "::");
+    fprintf(stderr, "FAIL: %s %s %s\n", pattern.c_str(), expected ? "should match" : "should not match",
+            (qualified + name).c_str());
+    failures++;
+}
+
+static void checkIndex(bool expected, const char *what)
+{
+    if (expected)
+        return;
+    fprintf(stderr, "FAIL: %s\n", what);
+    failures++;
+}
+
+// qualified names are found by their last component only
+static void testIndex()
+{
+    string path = (std::filesystem::temp_directory_path() / "topology_test.json").string();
+    {
+        std::ofstream out(path);
+        out << R"({"source_path": "/src", "enclaves": [], "levels": ["orange"],
+                   "functions": [{"name": "f", "level": "orange"},
+                                 {"name": "ns::f", "level": "orange"},
+                                 {"name": "::ns::f", "level": "orange"},
+                                 {"name": "Foo::g", "level": "orange"}],
+                   "global_scoped_vars": [{"name": "ns::v", "level": "orange"}]})";
+    }
+    Topology topology;
+    topology.parse(path);
+    std::filesystem::remove(path);
+
+    checkIndex(topology.isFunction("f"), "f is an unqualified function");
+    checkIndex(!topology.isFunction("g"), "g is only annotated qualified");
+
+    const vector<string> *f = topology.getQualifiedFunctionNames("f");
+    checkIndex(f && *f == vector<string>({ "ns::f", "::ns::f" }), "ns::f and ::ns::f are indexed under f");
+    const vector<string> *g = topology.getQualifiedFunctionNames("g");
+    checkIndex(g && *g == vector<string>({ "Foo::g" }), "Foo::g is indexed under g");
+    checkIndex(!topology.getQualifiedFunctionNames("ns"), "nothing is indexed under a scope");
+    checkIndex(!topology.getQualifiedFunctionNames("v"), "functions and variables are indexed apart");
+
+    const vector<string> *v = topology.getQualifiedGlobalScopedVarNames("v");
+    checkIndex(v && *v == vector<string>({ "ns::v" }), "ns::v is indexed under v");
+}
+
+int main()
+{
+    vector<NameScope> global = {};
+    vector<NameScope> ns = { { "ns" } };
+    vector<NameScope> nested = { { "outer" }, { "ns" } };
+    vector<NameScope> inClass = { { "ns" }, { "Foo" } };
+    vector<NameScope> inlined = { { "ns" }, { "v1", true } };
+    vector<NameScope> anonymous = { { "ns" }, { "(anonymous namespace)" } };
+
+    // unqualified: any scope
+    check(true, "f", global, "f");
+    check(true, "f", nested, "f");
+    check(false, "f", ns, "g");
+
+    // qualified: a suffix of the qualified name, at a scope boundary
+    check(true, "ns::f", ns, "f");
+    check(true, "ns::f", nested, "f");
+    check(true, "outer::ns::f", nested, "f");
+    check(false, "ns::f", global, "f");
+    check(false, "ns::f", inClass, "f");
+    check(false, "s::f", ns, "f");
+    check(true, "Foo::f", inClass, "f");
+    check(true, "ns::Foo::f", inClass, "f");
+
+    // fully qualified: the whole name
+    check(true, "::f", global, "f");
+    check(false, "::f", ns, "f");
+    check(true, "::ns::f", ns, "f");
+    check(false, "::ns::f", nested, "f");
+    check(true, "::outer::ns::f", nested, "f");
+
+    // inline namespaces may be left out, or named
+    check(true, "ns::f", inlined, "f");
+    check(true, "::ns::f", inlined, "f");
+    check(true, "ns::v1::f", inlined, "f");
+    check(true, "::ns::v1::f", inlined, "f");
+    check(true, "v1::f", inlined, "f");
+    check(false, "::v1::f", inlined, "f");
+
+    // anonymous namespaces are named as hasName() names them, and cannot
+    // be left out of a fully qualified name
+    check(true, "ns::(anonymous namespace)::f", anonymous, "f");
+    check(true, "(anonymous namespace)::f", anonymous, "f");
+    check(false, "::ns::f", anonymous, "f");
+    check(false, "ns::f", anonymous, "f");
+
+    testIndex();
+
+    if (failures == 0)
+        printf("all tests passed\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -1,59 +1,193 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <unordered_map>
 #include <filesystem>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include "llvm/IR/PassManager.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include "capo/Trace.h"
+
 
 using namespace llvm;
 
 namespace {
 
-unsigned long long int get_file_offset(std::string src_file_path, unsigned int line, unsigned int column) {
+cl::opt<std::string> TraceFile("declare-csv-trace",
+    cl::desc("write the phase timings and peak RSS of declare-csv to this Chrome trace JSON file"),
+    cl::init(""));
+
+// Start of every line of a source file, read once per file instead of once
+// per declaration.
+struct LineIndex {
+    sys::TimePoint<> modification_time;
+    uint64_t size = 0;
+    bool readable = false;
+    std::vector<uint64_t> newlines;  // offset of every '\n', in order
+    uint64_t end = 0;                // bytes that can be addressed
+};
+
+// Shared by all modules in the process; the pass may run on several modules
+// concurrently (e.g. in a parallel LTO link).
+std::mutex line_index_mutex;
+std::unordered_map<std::string, std::shared_ptr<const LineIndex>> line_indices;
+
+std::shared_ptr<const LineIndex> get_line_index(const std::string &src_file_path) {
+
+    sys::fs::file_status status;
+    bool exists = !sys::fs::status(src_file_path, status);
+
+    {
+        std::lock_guard<std::mutex> lock(line_index_mutex);
+        auto it = line_indices.find(src_file_path);
+        if (it != line_indices.end() && (!exists ||
+                (it->second->modification_time == status.getLastModificationTime() &&
+                 it->second->size == status.getSize()))) {
+            return it->second;
+        }
+    }
+
+    // built outside the lock; a concurrent build of the same file gives the same index
+    capo::trace::Scope scope("index source", capo::trace::IO, src_file_path);
+    auto index = std::make_shared<LineIndex>();
+    if (exists) {
+        index->modification_time = status.getLastModificationTime();
+        index->size = status.getSize();
+    }
 
-    char ch;
-    unsigned int line_count = 1;
-    unsigned int column_count = 1;
-    unsigned long long int file_offset = 0;
+    ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(src_file_path);
+    if (buffer) {
+        index->readable = true;
+        StringRef data = (*buffer)->getBuffer();
+
+        // Reading the file a char at a time stopped at the first 0xff byte,
+        // which compares equal to EOF where char is signed.
+        if (std::numeric_limits<char>::is_signed) {
+            data = data.take_front(data.find((char) EOF));
+        }
+        index->end = data.size();
+        for (size_t pos = data.find('\n'); pos != StringRef::npos; pos = data.find('\n', pos + 1)) {
+            index->newlines.push_back(pos);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(line_index_mutex);
+    return line_indices[src_file_path] = index;
+}
+
+// One past the offset of the given 1-based line and column, ~0 if the
+// position is not in the file.
+unsigned long long int get_file_offset(std::string src_file_path, unsigned int line, unsigned int column) {
 
     if (line < 1 || column < 1) {
         return 0;
     }
 
-    FILE * file_stream = fopen(src_file_path.c_str(), "r");
-    if (file_stream == NULL) {
+    std::shared_ptr<const LineIndex> index = get_line_index(src_file_path);
+    if (!index->readable) {
         errs() << "WARNING: Could not read source file: " << src_file_path.c_str() << "\n";
         return ~0;
     }
 
-    while(fread(&ch, 1, 1, file_stream)) {
-        file_offset++;
-        if (ch == EOF) break;
-        if (ch == '\n') {
-            line_count ++;
-            column_count = 1;
-        }
+    // Line 1 starts at offset 0; every later line is counted from the
+    // newline that ends the previous one, as the byte-wise scan did.
+    const std::vector<uint64_t> &newlines = index->newlines;
+    if (line - 1 > newlines.size()) {
+        return ~0;
+    }
+    uint64_t line_base = line == 1 ? 0 : newlines[line - 2];
+    uint64_t line_end = line - 1 < newlines.size() ? newlines[line - 1] : index->end;
 
-        if (line_count == line && column_count == column) {
-            fclose(file_stream);
-            return file_offset;
-        }
+    uint64_t file_offset = line_base + column;
+    if (file_offset > line_end) {
+        return ~0;
+    }
+    return file_offset;
+}
+
+
+// Replaces path atomically, so that concurrent runs never leave a partially
+// written file behind.
+void write_csv(const std::string &path, const std::string &contents) {
 
-        column_count++;
+    int fd;
+    SmallString<128> tmp_path;
+    if (std::error_code ec = sys::fs::createUniqueFile(path + ".%%%%%%.tmp", fd, tmp_path)) {
+        errs() << "ERROR: Could not write " << path << ": " << ec.message() << "\n";
+        return;
     }
 
-    fclose(file_stream);
-    return ~0;
+    {
+        raw_fd_ostream stream(fd, /* shouldClose */ true);
+        stream << contents;
+    }
+
+    if (std::error_code ec = sys::fs::rename(tmp_path, path)) {
+        errs() << "ERROR: Could not write " << path << ": " << ec.message() << "\n";
+        sys::fs::remove(tmp_path);
+    }
+}
+
+
+// The trace covers the process, not a module: it is started by the first
+// module and written at exit, so that modules run concurrently share it.
+void start_trace() {
+    static std::once_flag started;
+    std::call_once(started, []() {
+        capo::trace::enable(TraceFile, "declare-csv");
+        // constructed after the tracer, so destroyed before it
+        static struct Writer {
+            ~Writer() { capo::trace::finish(); }
+        } writer;
+    });
+}
+
+
+// The rows of every module run in the process, by module identifier.
+// declares.csv is written once, at exit, with the modules in identifier
+// order, so that concurrent modules do not replace each other's rows.
+std::mutex declares_mutex;
+std::map<std::string, std::string> declares;
+
+void add_declares(const std::string &module, const std::string &rows) {
+    static std::once_flag registered;
+    std::call_once(registered, []() {
+        // constructed after the trace writer, so written while it still traces
+        static struct Writer {
+            ~Writer() {
+                capo::trace::Scope scope("write declares.csv", capo::trace::IO);
+                std::string contents;
+                for (auto &module_rows : declares) {
+                    contents += module_rows.second;
+                }
+                write_csv("declares.csv", contents);
+            }
+        } writer;
+    });
+
+    std::lock_guard<std::mutex> lock(declares_mutex);
+    declares[module] += rows;
 }
 
 
 struct ExtractDeclares : public PassInfoMixin<ExtractDeclares> {
     PreservedAnalyses run(Module &module, ModuleAnalysisManager &MAM) {
 
+        if (!TraceFile.empty())
+            start_trace();
+        capo::trace::Scope module_scope("module", capo::trace::TOOL, module.getModuleIdentifier());
+
         unsigned int ll_fn_instruction_num;
         unsigned int referenced_fn_instruction_num;
         StringRef ll_fn_name;
@@ -74,10 +208,11 @@ struct ExtractDeclares : public PassInfoMixin<ExtractDeclares> {
         Metadata * declare_arg_3;  // The third argument is a complex expression.
         User::op_iterator declare_arg_it;
 
-        std::ofstream csv_file;
-        csv_file.open("declares.csv");
+        // Added to declares.csv, which is written at exit
+        std::ostringstream csv_file;
 
         // Global declarations
+        uint64_t phase_start = capo::trace::now();
         for (auto &global_var : module.getGlobalList()) {
             src_variable_name = global_var.getName();
 
@@ -116,7 +251,10 @@ struct ExtractDeclares : public PassInfoMixin<ExtractDeclares> {
                 << src_variable_name.str() << "\n";
         }
 
+        capo::trace::complete("globals", capo::trace::EXPORT, phase_start);
+
         // Local declarations via @llvm.dbg.declare
+        phase_start = capo::trace::now();
         for (auto &caller_function : module) {
 
             ll_fn_instruction_num = 0;
@@ -201,7 +339,10 @@ struct ExtractDeclares : public PassInfoMixin<ExtractDeclares> {
             }
         }
         
-        csv_file.close();
+        capo::trace::complete("dbg.declare", capo::trace::EXPORT, phase_start);
+
+        add_declares(module.getModuleIdentifier(), csv_file.str());
+
         return PreservedAnalyses::all();
     }
 };
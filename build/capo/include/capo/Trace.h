@@ -0,0 +1,319 @@
+// Phase timings for the CAPO tools, written as Chrome trace JSON
+// (chrome://tracing, https://ui.perfetto.dev).
+//
+// Tracing is off unless a tool calls capo::trace::enable() from its --trace
+// style flag. The trace holds one complete event per scope, on the thread
+// that ran it, and the peak RSS of the process when it is written. A "%p" in
+// the path is replaced by the process ID, so that tools run once per file do
+// not overwrite each other.
+//
+// The detail of an event is a string taken by reference, or a callable that
+// returns one; either is only read when tracing is on, so a disabled Scope
+// costs one relaxed load. Pass a callable for a detail that has to be built.
+//
+// A phase that runs in many short pieces, such as once per declaration, is
+// summed by a Total and recorded as a single event, ending where it is
+// recorded and marked with the number of pieces. Record it inside the scope
+// that ran the pieces, so that readers can take it out of that scope's time.
+//
+//     capo::trace::enable(TraceFile, "divider");
+//     {
+//         capo::trace::Scope scope("matching", capo::trace::MATCH, file);
+//         ...
+//     }
+//     {
+//         capo::trace::Scope scope("module", capo::trace::TOOL,
+//                                  [&]() { return "module " + name; });
+//         ...
+//     }
+//     capo::trace::Total graph("graph build", capo::trace::GRAPH);
+//     for (Decl *decl : decls) {
+//         capo::trace::Total::Piece piece(graph);
+//         ...
+//     }
+//     graph.record();
+//     capo::trace::finish();
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace capo {
+namespace trace {
+
+// categories of the events, by the phase they time
+constexpr const char *PARSE = "parse";
+constexpr const char *PREPROCESS = "preprocess";
+constexpr const char *MATCH = "match";
+constexpr const char *REWRITE = "rewrite";
+constexpr const char *GRAPH = "graph";
+constexpr const char *EXPORT = "export";
+constexpr const char *IO = "io";
+constexpr const char *TOOL = "tool";
+
+struct Event {
+    std::string name;
+    const char *category;
+    std::string detail;
+    uint64_t start;   // microseconds since enable()
+    uint64_t duration;
+    uint32_t thread;
+    uint64_t pieces;  // of a Total, 0 for a scope
+};
+
+class Tracer
+{
+public:
+    static Tracer &get() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    void enable(const std::string &path, const std::string &process) {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->path = path;
+        size_t pid = this->path.find("%p");
+        if (pid != std::string::npos)
+            this->path.replace(pid, 2, std::to_string(getpid()));
+        this->process = process;
+        origin = std::chrono::steady_clock::now();
+        on.store(true, std::memory_order_relaxed);
+    }
+
+    bool enabled() const { return on.load(std::memory_order_relaxed); }
+
+    uint64_t now() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - origin).count();
+    }
+
+    void complete(std::string name, const char *category, std::string detail, uint64_t start) {
+        uint64_t end = now();
+        uint32_t thread = threadId();
+        std::lock_guard<std::mutex> lock(mutex);
+        events.push_back({ std::move(name), category, std::move(detail), start, end - start, thread, 0 });
+    }
+
+    // Records pieces lasting duration in all as one event ending now
+    void total(std::string name, const char *category, std::string detail,
+               uint64_t duration, uint64_t pieces) {
+        uint64_t end = now();
+        uint64_t start = end > duration ? end - duration : 0;
+        uint32_t thread = threadId();
+        std::lock_guard<std::mutex> lock(mutex);
+        events.push_back({ std::move(name), category, std::move(detail), start, end - start, thread, pieces });
+    }
+
+    // peak resident set size in kilobytes
+    static long peakRss() {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    // Writes the trace; false if it is disabled or cannot be written
+    bool finish() {
+        if (!enabled())
+            return false;
+        std::lock_guard<std::mutex> lock(mutex);
+        on.store(false, std::memory_order_relaxed);
+
+        FILE *out = fopen(path.c_str(), "w");
+        if (!out) {
+            perror(path.c_str());
+            return false;
+        }
+
+        long rss = peakRss();
+        int pid = getpid();
+        fprintf(out, "{\"traceEvents\":[\n");
+        fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"%s\"}}",
+                pid, escape(process).c_str());
+        for (const Event &e : events) {
+            fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,"
+                         "\"pid\":%d,\"tid\":%u",
+                    escape(e.name).c_str(), e.category, (unsigned long long) e.start,
+                    (unsigned long long) e.duration, pid, e.thread);
+            if (!e.detail.empty() || e.pieces) {
+                fprintf(out, ",\"args\":{");
+                if (!e.detail.empty())
+                    fprintf(out, "\"detail\":\"%s\"%s", escape(e.detail).c_str(), e.pieces ? "," : "");
+                if (e.pieces)
+                    fprintf(out, "\"pieces\":%llu", (unsigned long long) e.pieces);
+                fprintf(out, "}");
+            }
+            fprintf(out, "}");
+        }
+        fprintf(out, ",\n{\"name\":\"peak RSS\",\"ph\":\"C\",\"ts\":%llu,\"pid\":%d,\"tid\":0,"
+                     "\"args\":{\"kb\":%ld}}",
+                (unsigned long long) now(), pid, rss);
+        fprintf(out, "\n],\n\"displayTimeUnit\":\"ms\",\n\"otherData\":{\"tool\":\"%s\",\"peak_rss_kb\":%ld}}\n",
+                escape(process).c_str(), rss);
+        fclose(out);
+        events.clear();
+        return true;
+    }
+
+private:
+    static uint32_t threadId() {
+        static std::atomic<uint32_t> next { 1 };
+        thread_local uint32_t id = next++;
+        return id;
+    }
+
+    static std::string escape(const std::string &s) {
+        std::string out;
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if ((unsigned char) c < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            } else {
+                out += c;
+            }
+        }
+        return out;
+    }
+
+    std::atomic<bool> on { false };
+    std::mutex mutex;
+    std::string path, process;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    std::vector<Event> events;
+};
+
+// The text of a detail: the string itself, or what the callable returns
+inline std::string describe(const char *detail) { return detail; }
+inline std::string describe(const std::string &detail) { return detail; }
+
+template <typename F, typename = std::enable_if_t<std::is_invocable_v<const F &>>>
+inline std::string describe(const F &detail) { return detail(); }
+
+inline void enable(const std::string &path, const std::string &process) {
+    Tracer::get().enable(path, process);
+}
+
+inline bool enabled() { return Tracer::get().enabled(); }
+
+inline uint64_t now() { return Tracer::get().enabled() ? Tracer::get().now() : 0; }
+
+// Records a phase that started at start (from now()) and ends here
+inline void complete(const char *name, const char *category, uint64_t start) {
+    if (Tracer::get().enabled())
+        Tracer::get().complete(name, category, "", start);
+}
+
+template <typename Detail>
+inline void complete(const char *name, const char *category, uint64_t start, const Detail &detail) {
+    if (Tracer::get().enabled())
+        Tracer::get().complete(name, category, describe(detail), start);
+}
+
+inline bool finish() { return Tracer::get().finish(); }
+
+// Times the enclosing block
+class Scope
+{
+public:
+    Scope(const char *name, const char *category)
+        : name(name), category(category) {
+        if (Tracer::get().enabled()) {
+            active = true;
+            start = Tracer::get().now();
+        }
+    }
+
+    template <typename Detail>
+    Scope(const char *name, const char *category, const Detail &detail)
+        : name(name), category(category) {
+        if (Tracer::get().enabled()) {
+            active = true;
+            this->detail = describe(detail);
+            start = Tracer::get().now();
+        }
+    }
+
+    ~Scope() {
+        if (active && Tracer::get().enabled())
+            Tracer::get().complete(name, category, std::move(detail), start);
+    }
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+private:
+    const char *name;
+    const char *category;
+    std::string detail;
+    uint64_t start = 0;
+    bool active = false;
+};
+
+// Sums the pieces of a phase on one thread and records them as one event
+class Total
+{
+public:
+    Total(const char *name, const char *category)
+        : name(name), category(category) {
+    }
+
+    // Times the enclosing block as one piece of the total
+    class Piece
+    {
+    public:
+        explicit Piece(Total &total) : total(total) {
+            if (Tracer::get().enabled()) {
+                active = true;
+                start = Tracer::get().now();
+            }
+        }
+
+        ~Piece() {
+            if (active && Tracer::get().enabled()) {
+                total.duration += Tracer::get().now() - start;
+                total.pieces++;
+            }
+        }
+
+        Piece(const Piece &) = delete;
+        Piece &operator=(const Piece &) = delete;
+
+    private:
+        Total &total;
+        uint64_t start = 0;
+        bool active = false;
+    };
+
+    // Records the pieces so far, if any, and starts over
+    void record() { record(""); }
+
+    template <typename Detail>
+    void record(const Detail &detail) {
+        if (pieces && Tracer::get().enabled())
+            Tracer::get().total(name, category, describe(detail), duration, pieces);
+        duration = 0;
+        pieces = 0;
+    }
+
+private:
+    const char *name;
+    const char *category;
+    uint64_t duration = 0;
+    uint64_t pieces = 0;
+};
+
+} // namespace trace
+} // namespace capo
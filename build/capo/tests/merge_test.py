@@ -0,0 +1,80 @@
+import os
+import sys
+import glob
+import shutil
+import subprocess
+from pathlib import Path
+
+import pytest
+
+CLANG_14_EXECUTABLE = os.environ['CLANG_14_EXECUTABLE']
+
+CLANG_PLUGIN_SO = os.path.abspath(glob.glob('../clang-plugin/build/CLE.*').pop())
+MERGE_SCRIPT = os.path.abspath('../clang-plugin/merge.py')
+
+CPP_TEST_SRC_DIR = os.path.abspath('cpp')
+
+TMP_DIR = 'intermediate'
+EDGES_CSV = 'edges.csv'
+NODES_CSV = 'nodes.csv'
+COLLATED_JSON = 'collated.json'
+DECLS_CSV = 'decls.csv'
+
+
+def run_clang_plugin(cpp_file_name, work_dir, shard_dir=None):
+    command = [
+        CLANG_14_EXECUTABLE,
+        '-g',
+        '-c',
+        '-o', os.devnull,
+        '-Xclang', '-load',
+        '-Xclang', CLANG_PLUGIN_SO,
+        '-Xclang', '-plugin',
+        '-Xclang', 'cle',
+    ]
+    if shard_dir:
+        command += ['-Xclang', '-plugin-arg-cle', '-Xclang', f'shard-dir={shard_dir}']
+    command.append(f'{CPP_TEST_SRC_DIR}/{cpp_file_name}')
+
+    os.makedirs(work_dir, exist_ok=True)
+    status = subprocess.run(command, stdout=subprocess.PIPE, cwd=work_dir, env=os.environ)
+    assert status.returncode == 0
+
+
+def run_merge(output_dir, shard_dir):
+    command = (
+        sys.executable,
+        MERGE_SCRIPT,
+        '-o', output_dir,
+        shard_dir
+    )
+    status = subprocess.run(command, stdout=subprocess.PIPE)
+    assert status.returncode == 0
+
+
+def read(path):
+    with open(path, 'rb') as f:
+        return f.read()
+
+
+# Merging the single shard of a translation unit has to give back the tables
+# the plugin writes without shard-dir, byte for byte.
+@pytest.mark.parametrize('cpp_file_name', sorted(os.path.basename(f) for f in glob.glob('cpp/*.cpp')))
+def test_merge_single_shard(cpp_file_name):
+    work_dir = os.path.abspath(f'{TMP_DIR}/merge/{Path(cpp_file_name).stem}')
+    shutil.rmtree(work_dir, ignore_errors=True)
+    plain_dir = f'{work_dir}/plain'
+    shard_dir = f'{work_dir}/shards'
+    merged_dir = f'{work_dir}/merged'
+
+    run_clang_plugin(cpp_file_name, plain_dir)
+    run_clang_plugin(cpp_file_name, f'{work_dir}/sharded', shard_dir)
+
+    shards = [root for root, _, files in os.walk(shard_dir) if NODES_CSV in files]
+    assert len(shards) == 1
+    assert os.path.isfile(f'{shards[0]}/{DECLS_CSV}')
+
+    run_merge(merged_dir, shard_dir)
+
+    for name in (NODES_CSV, EDGES_CSV, COLLATED_JSON):
+        assert read(f'{merged_dir}/{name}') == read(f'{plain_dir}/{name}'), name